@@ -6,7 +6,7 @@
       'cflags_cc!': [ '-fno-exceptions' ],
       'conditions': [
         ['OS=="mac"', {
-          'sources': [ 'lib/kerberos.cc', 'lib/worker.cc', 'lib/kerberosgss.c', 'lib/base64.c', 'lib/kerberos_context.cc' ],
+          'sources': [ 'lib/kerberos.cc', 'lib/operation.cc', 'lib/thread_pool.cc', 'lib/stats.cc', 'lib/trace.cc', 'lib/kerberosgss.c', 'lib/base64.c', 'lib/kerberos_context.cc', 'lib/kerberos_credential.cc' ],
           'defines': [
             '__MACOSX_CORE__'
           ],
@@ -19,6 +19,16 @@
             ]
           }
         }],
+        ['OS=="linux"', {
+          'sources': [ 'lib/kerberos.cc', 'lib/operation.cc', 'lib/thread_pool.cc', 'lib/stats.cc', 'lib/trace.cc', 'lib/kerberosgss.c', 'lib/base64.c', 'lib/kerberos_context.cc', 'lib/kerberos_credential.cc' ],
+          "link_settings": {
+            "libraries": [
+              "-lgssapi_krb5",
+              "-lkrb5",
+              "-lpthread"
+            ]
+          }
+        }],
         ['OS=="win"',  {
           'sources': [ 
             'lib/win32/kerberos.cc', 
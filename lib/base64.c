@@ -21,6 +21,16 @@
 #include <stdio.h>
 #include <errno.h>
 
+// Vector engines. x86 ones are compiled with per-function target attributes
+// and picked at runtime, NEON is part of the aarch64 baseline.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define BASE64_X86 1
+# include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# define BASE64_NEON 1
+# include <arm_neon.h>
+#endif
+
 void die2(const char *message) {
   if(errno) {
     perror(message);
@@ -47,6 +57,347 @@ static signed char index_64[128] =
 };
 #define CHAR64(c)  (((c) < 0 || (c) > 127) ? -1 : index_64[(c)])
 
+// Block codecs
+//
+// An encoder consumes whole 3 byte groups from the front of value and returns
+// the number of input bytes it handled, leaving the tail to the scalar loop.
+// A decoder consumes whole 4 char groups that contain only alphabet chars (no
+// padding, no garbage) and stops at the first block that does not, so the
+// scalar loop sees exactly the input it would have seen on its own. Decoders
+// may store up to 8 bytes past the group they produce but only while at least
+// 16 more input chars remain, so the write stays inside a (len * 3) / 4 buffer.
+typedef size_t (*base64_encode_blocks_fn)(const unsigned char *value, size_t vlen, char *out);
+typedef size_t (*base64_decode_blocks_fn)(const char *value, size_t vlen, unsigned char *out);
+
+static size_t base64_encode_blocks_scalar(const unsigned char *value, size_t vlen, char *out)
+{
+    (void)value; (void)vlen; (void)out;
+    return 0;
+}
+
+static size_t base64_decode_blocks_scalar(const char *value, size_t vlen, unsigned char *out)
+{
+    (void)value; (void)vlen; (void)out;
+    return 0;
+}
+
+#ifdef BASE64_X86
+
+// 12 input bytes -> 16 sextets, one per byte lane
+__attribute__((target("ssse3")))
+static inline __m128i base64_enc_reshuffle_ssse3(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// 16 sextets -> 16 ascii chars of basis_64
+__attribute__((target("ssse3")))
+static inline __m128i base64_enc_translate_ssse3(__m128i in)
+{
+    const __m128i lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    idx = _mm_or_si128(idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
+
+__attribute__((target("ssse3")))
+static size_t base64_encode_blocks_ssse3(const unsigned char *value, size_t vlen, char *out)
+{
+    size_t done = 0;
+    // Loads are 16 bytes wide but only 12 are consumed
+    while (vlen - done >= 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(value + done));
+        in = base64_enc_translate_ssse3(base64_enc_reshuffle_ssse3(in));
+        _mm_storeu_si128((__m128i *)out, in);
+        out += 16;
+        done += 12;
+    }
+    return done;
+}
+
+// 16 ascii chars -> 12 bytes, returns 0 if any char is outside the alphabet
+__attribute__((target("ssse3")))
+static inline int base64_dec_block_ssse3(__m128i in, __m128i *result)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_0f = _mm_set1_epi8(0x0f);
+
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_0f);
+    const __m128i lo_nibbles = _mm_and_si128(in, mask_0f);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(bad) != 0xffff)
+        return 0;
+
+    const __m128i eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    const __m128i sextets = _mm_add_epi8(in, roll);
+
+    const __m128i merged = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+    const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    *result = _mm_shuffle_epi8(packed, _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return 1;
+}
+
+__attribute__((target("ssse3")))
+static size_t base64_decode_blocks_ssse3(const char *value, size_t vlen, unsigned char *out)
+{
+    size_t done = 0;
+    __m128i block;
+    while (vlen - done >= 32)
+    {
+        if (!base64_dec_block_ssse3(_mm_loadu_si128((const __m128i *)(value + done)), &block))
+            break;
+        _mm_storeu_si128((__m128i *)out, block);
+        out += 12;
+        done += 16;
+    }
+    return done;
+}
+
+__attribute__((target("avx2")))
+static size_t base64_encode_blocks_avx2(const unsigned char *value, size_t vlen, char *out)
+{
+    const __m256i shuffle = _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t done = 0;
+    // Two 12 byte groups per iteration, the upper one loaded at +12
+    while (vlen - done >= 28)
+    {
+        const __m128i lo = _mm_loadu_si128((const __m128i *)(value + done));
+        const __m128i hi = _mm_loadu_si128((const __m128i *)(value + done + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        in = _mm256_shuffle_epi8(in, shuffle);
+        const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i sextets = _mm256_or_si256(t1, t3);
+
+        __m256i idx = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets);
+        idx = _mm256_or_si256(idx, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(sextets, _mm256_shuffle_epi8(lut, idx));
+
+        _mm256_storeu_si256((__m256i *)out, chars);
+        out += 32;
+        done += 24;
+    }
+    // Finish a trailing 12 byte group with the 128 bit kernel
+    return done + base64_encode_blocks_ssse3(value + done, vlen - done, out);
+}
+
+__attribute__((target("avx2")))
+static size_t base64_decode_blocks_avx2(const char *value, size_t vlen, unsigned char *out)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i mask_0f = _mm256_set1_epi8(0x0f);
+    size_t done = 0;
+
+    while (vlen - done >= 48)
+    {
+        const __m256i in = _mm256_loadu_si256((const __m256i *)(value + done));
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_0f);
+        const __m256i lo_nibbles = _mm256_and_si256(in, mask_0f);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        const __m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        const __m256i sextets = _mm256_add_epi8(in, roll);
+
+        const __m256i merged = _mm256_maddubs_epi16(sextets, _mm256_set1_epi32(0x01400140));
+        __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        packed = _mm256_shuffle_epi8(packed, pack);
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+        _mm256_storeu_si256((__m256i *)out, packed);
+        out += 24;
+        done += 32;
+    }
+    return done + base64_decode_blocks_ssse3(value + done, vlen - done, out);
+}
+
+#endif
+
+#ifdef BASE64_NEON
+
+static size_t base64_encode_blocks_neon(const unsigned char *value, size_t vlen, char *out)
+{
+    static const unsigned char *lut = (const unsigned char *)
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8x16x4_t tbl = vld1q_u8_x4(lut);
+    const uint8x16_t mask_3f = vdupq_n_u8(0x3f);
+    size_t done = 0;
+
+    while (vlen - done >= 48)
+    {
+        const uint8x16x3_t in = vld3q_u8(value + done);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(in.val[0], 2);
+        idx.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask_3f);
+        idx.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask_3f);
+        idx.val[3] = vandq_u8(in.val[2], mask_3f);
+
+        uint8x16x4_t chars;
+        chars.val[0] = vqtbl4q_u8(tbl, idx.val[0]);
+        chars.val[1] = vqtbl4q_u8(tbl, idx.val[1]);
+        chars.val[2] = vqtbl4q_u8(tbl, idx.val[2]);
+        chars.val[3] = vqtbl4q_u8(tbl, idx.val[3]);
+        vst4q_u8((unsigned char *)out, chars);
+        out += 64;
+        done += 48;
+    }
+    return done;
+}
+
+static size_t base64_decode_blocks_neon(const char *value, size_t vlen, unsigned char *out)
+{
+    // index_64 with 0xff for chars outside the alphabet, split in 64 byte halves
+    static const unsigned char lut[128] =
+    {
+        255,255,255,255, 255,255,255,255, 255,255,255,255, 255,255,255,255,
+        255,255,255,255, 255,255,255,255, 255,255,255,255, 255,255,255,255,
+        255,255,255,255, 255,255,255,255, 255,255,255, 62, 255,255,255, 63,
+         52, 53, 54, 55,  56, 57, 58, 59,  60, 61,255,255, 255,255,255,255,
+        255,  0,  1,  2,   3,  4,  5,  6,   7,  8,  9, 10,  11, 12, 13, 14,
+         15, 16, 17, 18,  19, 20, 21, 22,  23, 24, 25,255, 255,255,255,255,
+        255, 26, 27, 28,  29, 30, 31, 32,  33, 34, 35, 36,  37, 38, 39, 40,
+         41, 42, 43, 44,  45, 46, 47, 48,  49, 50, 51,255, 255,255,255,255
+    };
+    const uint8x16x4_t tbl_lo = vld1q_u8_x4(lut);
+    const uint8x16x4_t tbl_hi = vld1q_u8_x4(lut + 64);
+    const uint8x16_t sixty_four = vdupq_n_u8(64);
+    size_t done = 0;
+
+    // vst3q_u8 writes exactly 48 bytes, no overrun
+    while (vlen - done >= 64)
+    {
+        const uint8x16x4_t in = vld4q_u8((const unsigned char *)value + done);
+        uint8x16x4_t v;
+        uint8x16_t bad = vdupq_n_u8(0);
+        int i;
+        for (i = 0; i < 4; i++)
+        {
+            v.val[i] = vqtbl4q_u8(tbl_lo, in.val[i]);
+            v.val[i] = vqtbx4q_u8(v.val[i], tbl_hi, vsubq_u8(in.val[i], sixty_four));
+            // High bit set either for a non ascii char or an 0xff table entry
+            bad = vorrq_u8(bad, vorrq_u8(v.val[i], in.val[i]));
+        }
+        if (vmaxvq_u8(bad) & 0x80)
+            break;
+
+        uint8x16x3_t res;
+        res.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2), vshrq_n_u8(v.val[1], 4));
+        res.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4), vshrq_n_u8(v.val[2], 2));
+        res.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+        vst3q_u8(out, res);
+        out += 48;
+        done += 64;
+    }
+    return done;
+}
+
+#endif
+
+static base64_encode_blocks_fn base64_encode_blocks = NULL;
+static base64_decode_blocks_fn base64_decode_blocks = NULL;
+
+// Pick the widest codec the cpu supports, overridable with
+// KERBEROS_BASE64=scalar|ssse3|avx2 for benchmarking. Racing callers all
+// store the same pointers so no locking is needed.
+static void base64_select_codec(void)
+{
+    base64_encode_blocks_fn encode = base64_encode_blocks_scalar;
+    base64_decode_blocks_fn decode = base64_decode_blocks_scalar;
+    const char *force = getenv("KERBEROS_BASE64");
+
+#if defined(BASE64_X86)
+    __builtin_cpu_init();
+    if (force == NULL || strcmp(force, "scalar") != 0)
+    {
+        if (__builtin_cpu_supports("ssse3"))
+        {
+            encode = base64_encode_blocks_ssse3;
+            decode = base64_decode_blocks_ssse3;
+        }
+        if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "ssse3") != 0))
+        {
+            encode = base64_encode_blocks_avx2;
+            decode = base64_decode_blocks_avx2;
+        }
+    }
+#elif defined(BASE64_NEON)
+    if (force == NULL || strcmp(force, "scalar") != 0)
+    {
+        encode = base64_encode_blocks_neon;
+        decode = base64_decode_blocks_neon;
+    }
+#else
+    (void)force;
+#endif
+
+    base64_decode_blocks = decode;
+    base64_encode_blocks = encode;
+}
+
+// base64_codec_name    :    name of the block codec in use
+//
+// (result)             :    static c-str, "scalar", "ssse3", "avx2" or "neon"
+const char *base64_codec_name(void)
+{
+    if (base64_encode_blocks == NULL) base64_select_codec();
+#if defined(BASE64_X86)
+    if (base64_encode_blocks == base64_encode_blocks_avx2) return "avx2";
+    if (base64_encode_blocks == base64_encode_blocks_ssse3) return "ssse3";
+#elif defined(BASE64_NEON)
+    if (base64_encode_blocks == base64_encode_blocks_neon) return "neon";
+#endif
+    return "scalar";
+}
+
 // base64_encode    :    base64 encode
 //
 // value            :    data to encode
@@ -57,6 +408,16 @@ char *base64_encode(const unsigned char *value, int vlen)
     char *result = (char *)malloc((vlen * 4) / 3 + 5);
     if(result == NULL) die2("Memory allocation failed");
     char *out = result;
+
+    if (base64_encode_blocks == NULL) base64_select_codec();
+    if (vlen > 0)
+    {
+        size_t done = base64_encode_blocks(value, (size_t)vlen, out);
+        value += done;
+        vlen -= (int)done;
+        out += (done / 3) * 4;
+    }
+
     while (vlen >= 3)
     {
         *out++ = basis_64[value[0] >> 2];
@@ -80,55 +441,160 @@ char *base64_encode(const unsigned char *value, int vlen)
     return result;
 }
 
-// base64_decode    :    base64 decode
+// base64_decode_quads    :    decode whole 4 char groups
 //
-// value            :    c-str to decode
-// rlen             :    length of decoded result
-// (result)         :    new unsigned char[] - decoded result
-unsigned char *base64_decode(const char *value, int *rlen)
+// value                  :    chars to decode, vlen a multiple of 4
+// out                    :    buffer of at least (vlen / 4) * 3 bytes
+// rlen                   :    length of decoded result
+// (result)               :    0 on success, -1 on a char outside the alphabet
+static int base64_decode_quads(const char *value, size_t vlen, unsigned char *out, size_t *rlen)
 {
-    *rlen = 0;
     int c1, c2, c3, c4;
+    const char *end = value + vlen;
+    unsigned char *start = out;
 
-    int vlen = strlen(value);
-    unsigned char *result =(unsigned char *)malloc((vlen * 3) / 4 + 1);
-    if(result == NULL) die2("Memory allocation failed");    
-    unsigned char *out = result;
+    // Bulk of the token, stops short of padding or bad input
+    if (base64_decode_blocks == NULL) base64_select_codec();
+    if (vlen > 0)
+    {
+        size_t done = base64_decode_blocks(value, vlen, out);
+        value += done;
+        out += (done / 4) * 3;
+    }
 
-    while (1)
+    while (value < end)
     {
-        if (value[0]==0)
-            return result;
         c1 = value[0];
         if (CHAR64(c1) == -1)
-            goto base64_decode_error;;
+            goto base64_decode_error;
         c2 = value[1];
         if (CHAR64(c2) == -1)
-            goto base64_decode_error;;
+            goto base64_decode_error;
         c3 = value[2];
         if ((c3 != '=') && (CHAR64(c3) == -1))
-            goto base64_decode_error;;
+            goto base64_decode_error;
         c4 = value[3];
         if ((c4 != '=') && (CHAR64(c4) == -1))
-            goto base64_decode_error;;
+            goto base64_decode_error;
 
         value += 4;
         *out++ = (CHAR64(c1) << 2) | (CHAR64(c2) >> 4);
-        *rlen += 1;
         if (c3 != '=')
         {
             *out++ = ((CHAR64(c2) << 4) & 0xf0) | (CHAR64(c3) >> 2);
-            *rlen += 1;
             if (c4 != '=')
-            {
                 *out++ = ((CHAR64(c3) << 6) & 0xc0) | CHAR64(c4);
-                *rlen += 1;
-            }
         }
     }
 
+    *rlen = out - start;
+    return 0;
+
 base64_decode_error:
-    *result = 0;
     *rlen = 0;
+    return -1;
+}
+
+// base64_decode_len    :    base64 decode a counted string into a caller buffer
+//
+// value                :    chars to decode, need not be NUL terminated
+// vlen                 :    number of chars
+// out                  :    buffer of at least BASE64_DECODED_MAX(vlen) bytes
+// rlen                 :    length of decoded result
+// (result)             :    0 on success, -1 on invalid input (rlen is 0)
+int base64_decode_len(const char *value, size_t vlen, unsigned char *out, size_t *rlen)
+{
+    *rlen = 0;
+    if (vlen % 4 != 0)
+        return -1;
+    return base64_decode_quads(value, vlen, out, rlen);
+}
+
+// base64_decoder_init    :    reset an incremental decoder
+//
+// decoder                :    decoder state
+void base64_decoder_init(base64_decoder *decoder)
+{
+    decoder->npending = 0;
+    decoder->error = 0;
+}
+
+// base64_decoder_update    :    feed the next chunk of a token
+//
+// decoder                  :    decoder state
+// value                    :    chars to decode, any length
+// vlen                     :    number of chars
+// out                      :    buffer of at least BASE64_DECODED_MAX(vlen + 3) bytes
+// rlen                     :    length decoded by this call
+// (result)                 :    0 on success, -1 once invalid input was seen
+int base64_decoder_update(base64_decoder *decoder, const char *value, size_t vlen,
+                          unsigned char *out, size_t *rlen)
+{
+    size_t written = 0;
+    size_t bulk;
+
+    *rlen = 0;
+    if (decoder->error)
+        return -1;
+
+    // Complete a group split across chunks
+    if (decoder->npending > 0)
+    {
+        while (decoder->npending < 4 && vlen > 0)
+        {
+            decoder->pending[decoder->npending++] = *value++;
+            vlen--;
+        }
+        if (decoder->npending < 4)
+            return 0;
+        if (base64_decode_quads(decoder->pending, 4, out, &written) != 0)
+            goto base64_decoder_error;
+        decoder->npending = 0;
+    }
+
+    bulk = vlen & ~(size_t)3;
+    if (bulk > 0)
+    {
+        size_t len;
+        if (base64_decode_quads(value, bulk, out + written, &len) != 0)
+            goto base64_decoder_error;
+        written += len;
+    }
+
+    while (bulk < vlen)
+        decoder->pending[decoder->npending++] = value[bulk++];
+
+    *rlen = written;
+    return 0;
+
+base64_decoder_error:
+    decoder->error = 1;
+    return -1;
+}
+
+// base64_decoder_final    :    finish an incremental decode
+//
+// decoder                 :    decoder state
+// (result)                :    0 if the token was valid and complete, -1 otherwise
+int base64_decoder_final(base64_decoder *decoder)
+{
+    return (decoder->error || decoder->npending != 0) ? -1 : 0;
+}
+
+// base64_decode    :    base64 decode
+//
+// value            :    c-str to decode
+// rlen             :    length of decoded result
+// (result)         :    new unsigned char[] - decoded result
+unsigned char *base64_decode(const char *value, int *rlen)
+{
+    size_t vlen = strlen(value);
+    size_t len;
+    unsigned char *result = (unsigned char *)malloc((vlen * 3) / 4 + 1);
+    if(result == NULL) die2("Memory allocation failed");
+
+    if (base64_decode_len(value, vlen, result, &len) != 0)
+        *result = 0;
+    *rlen = (int)len;
     return result;
 }
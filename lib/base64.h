@@ -16,7 +16,26 @@
 #ifndef BASE64_H
 #define BASE64_H
 
+#include <stddef.h>
+
+// Upper bound on the bytes produced by decoding len base64 chars
+#define BASE64_DECODED_MAX(len) ((((len) + 3) / 4) * 3)
+
+// Incremental decoder, holds the chars of a group split across chunks
+typedef struct {
+  char pending[4];
+  int npending;
+  int error;
+} base64_decoder;
+
 char *base64_encode(const unsigned char *value, int vlen);
 unsigned char *base64_decode(const char *value, int *rlen);
+const char *base64_codec_name(void);
+
+int base64_decode_len(const char *value, size_t vlen, unsigned char *out, size_t *rlen);
+void base64_decoder_init(base64_decoder *decoder);
+int base64_decoder_update(base64_decoder *decoder, const char *value, size_t vlen,
+                          unsigned char *out, size_t *rlen);
+int base64_decoder_final(base64_decoder *decoder);
 
 #endif
\ No newline at end of file
@@ -1,8 +1,17 @@
 #include "kerberos.h"
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
-#include "worker.h"
+#include <node_buffer.h>
+#include "operation.h"
 #include "kerberos_context.h"
+#include "kerberos_credential.h"
+#include "stats.h"
+#include "trace.h"
+
+extern "C" {
+  #include "base64.h"
+}
 
 #ifndef ARRAY_SIZE
 # define ARRAY_SIZE(a) (sizeof((a)) / sizeof((a)[0]))
@@ -20,52 +29,118 @@ void die(const char *message) {
 
 Persistent<FunctionTemplate> Kerberos::constructor_template;
 
-// Call structs
-typedef struct AuthGSSClientCall {
-  uint32_t  flags;
-  char *uri;
-} AuthGSSClientCall;
-
-typedef struct AuthGSSClientStepCall {
-  KerberosContext *context;
-  char *challenge;
-} AuthGSSClientStepCall;
-
-typedef struct AuthGSSClientUnwrapCall {
-  KerberosContext *context;
-  char *challenge;
-} AuthGSSClientUnwrapCall;
-
-typedef struct AuthGSSClientWrapCall {
-  KerberosContext *context;
-  char *challenge;
-  char *user_name;
-} AuthGSSClientWrapCall;
-
-typedef struct AuthGSSClientCleanCall {
-  KerberosContext *context;
-} AuthGSSClientCleanCall;
-
-typedef struct AuthGSSServerCall {
-  char *uri;
-} AuthGSSServerCall;
-
-typedef struct AuthGSSServerStepCall {
-  KerberosContext *context;
-  char *challenge;
-} AuthGSSServerStepCall;
-
-typedef struct AuthGSSServerCleanCall {
-  KerberosContext *context;
-} AuthGSSServerCleanCall;
-
 // VException object (causes throw in calling code)
 static Handle<Value> VException(const char *msg) {
   HandleScope scope;
   return ThrowException(Exception::Error(String::New(msg)));
 }
 
-Kerberos::Kerberos() : ObjectWrap() {
+// Upper bound of the decoded size of a base64 challenge string
+static size_t ChallengeCapacity(Handle<String> challenge) {
+  return BASE64_DECODED_MAX((size_t)challenge->Length());
+}
+
+// Decode a base64 challenge string into out (ChallengeCapacity bytes) by
+// pulling the v8 string through a small stack buffer, avoiding both the
+// intermediate c-string copy and the strlen. Invalid input decodes to an
+// empty token, same as the old base64_decode.
+static size_t DecodeChallenge(Handle<String> challenge, unsigned char *out) {
+  uint16_t wide[256];
+  char narrow[256];
+  base64_decoder decoder;
+  size_t length = 0;
+  int total = challenge->Length();
+
+  base64_decoder_init(&decoder);
+
+  for(int start = 0; start < total; start += ARRAY_SIZE(wide)) {
+    int count = challenge->Write(wide, start, ARRAY_SIZE(wide), String::HINT_MANY_WRITES_EXPECTED);
+    size_t written = 0;
+
+    // Anything outside ascii can't be base64, map it to an invalid char
+    for(int i = 0; i < count; i++) {
+      narrow[i] = wide[i] > 127 ? '*' : (char)wide[i];
+    }
+
+    if(base64_decoder_update(&decoder, narrow, count, out + length, &written) != 0) return 0;
+    length += written;
+  }
+
+  return base64_decoder_final(&decoder) == 0 ? length : 0;
+}
+
+// Challenges are either base64 strings or raw Buffers
+static bool IsChallenge(Handle<Value> challenge) {
+  return challenge->IsString() || Buffer::HasInstance(challenge);
+}
+
+// Arguments shared by the operations that take a challenge token
+class ChallengeArgs {
+  public:
+    ChallengeArgs() : response_format(AUTH_GSS_RESPONSE_BASE64) {}
+
+    // Decode a base64 string or copy a raw Buffer into the token. A Buffer
+    // asks for a raw response, skipping base64 in both directions.
+    void Set(Handle<Value> challenge) {
+      if(Buffer::HasInstance(challenge)) {
+        size_t length = Buffer::Length(challenge);
+        memcpy(token.Reserve(length), Buffer::Data(challenge), length);
+        token.length = length;
+        response_format = AUTH_GSS_RESPONSE_RAW;
+      } else {
+        Local<String> string = challenge->ToString();
+        token.length = DecodeChallenge(string, token.Reserve(ChallengeCapacity(string)));
+        response_format = AUTH_GSS_RESPONSE_BASE64;
+      }
+    }
+
+    void Reset() {
+      token.length = 0;
+      response_format = AUTH_GSS_RESPONSE_BASE64;
+    }
+
+    OperationBuffer token;
+    int response_format;
+};
+
+// Size of the response a step left in the state
+static size_t ResponseLength(const char *response, gss_buffer_desc *response_token) {
+  return response != NULL ? strlen(response) : response_token->length;
+}
+
+// Move a gss_response into the result of an operation and free it
+static void SetResult(Operation *operation, gss_response *response) {
+  // If we have an error mark the operation as having had an error
+  if(response->return_code == AUTH_GSS_ERROR) {
+    operation->error = true;
+    operation->error_code = response->return_code;
+    operation->error_message = response->message;
+  } else {
+    operation->return_code = response->return_code;
+  }
+
+  // Keep the GSS status for the error counters
+  operation->major_status = response->major_status;
+  operation->minor_status = response->minor_status;
+  free(response);
+}
+
+ThreadPool *Kerberos::default_pool = NULL;
+uint32_t Kerberos::last_id = 0;
+
+// Samples needed before we trust the estimate of an operation type
+#define ADAPTIVE_MIN_SAMPLES 8
+// Default inline threshold, about what the hop to the pool and back costs
+#define ADAPTIVE_THRESHOLD_US 50
+// Default for what counts as a slow ticket fetch
+#define TRACE_THRESHOLD_MS 500
+
+Kerberos::Kerberos(ThreadPool *pool, bool owns_pool) : ObjectWrap(), pool(pool), owns_pool(owns_pool), pending_head(NULL), waiting_head(NULL), waiting_tail(NULL), queued(0), in_flight(0), max_in_flight(0), max_queued(-1), trace(false), trace_threshold(0), adaptive(false), inline_threshold(0), inline_cached(false) {
+}
+
+Kerberos::~Kerberos() {
+  // Every queued operation holds a reference, so the pool is idle by now
+  if(owns_pool) pool->Destroy();
 }
 
 void Kerberos::Initialize(v8::Handle<v8::Object> target) {
@@ -84,149 +159,867 @@ void Kerberos::Initialize(v8::Handle<v8::Object> target) {
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientWrap", AuthGSSClientWrap);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientClean", AuthGSSClientClean);
 
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "acquireCredential", AcquireCredential);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "prefetch", Prefetch);
+
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSServerInit", AuthGSSServerInit);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSServerStep", AuthGSSServerStep);
   NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSServerClean", AuthGSSServerClean);
 
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "cancel", Cancel);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "queueDepth", QueueDepth);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "inFlight", InFlight);
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientUnwrapSync", AuthGSSClientUnwrapSync);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientWrapSync", AuthGSSClientWrapSync);
+
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientStepMany", AuthGSSClientStepMany);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientUnwrapMany", AuthGSSClientUnwrapMany);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSClientWrapMany", AuthGSSClientWrapMany);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "authGSSServerStepMany", AuthGSSServerStepMany);
+
+  // Service name and acceptor credential caches, process wide
+  NODE_SET_METHOD(target, "clearServiceNames", ClearServiceNames);
+  NODE_SET_METHOD(target, "invalidateAcceptorCredentials", InvalidateAcceptorCredentials);
+  NODE_SET_METHOD(target, "setAcceptorCredentialTtl", SetAcceptorCredentialTtl);
+
   // Set the symbol
   target->ForceSet(String::NewSymbol("Kerberos"), constructor_template->GetFunction());
 }
 
+// Read { threads, threadName, cpus } into the pool options, any of them
+// gives the instance a pool of its own
+const char *Kerberos::ParseOptions(Handle<Object> object, ThreadPoolOptions *options, bool *dedicated) {
+  HandleScope scope;
+  Local<Value> threads = object->Get(String::NewSymbol("threads"));
+  Local<Value> thread_name = object->Get(String::NewSymbol("threadName"));
+  Local<Value> cpus = object->Get(String::NewSymbol("cpus"));
+
+  *dedicated = false;
+
+  if(!threads->IsUndefined()) {
+    if(!threads->IsInt32() || threads->Int32Value() < 1 || threads->Int32Value() > 256)
+      return "threads must be an integer between 1 and 256";
+    options->size = threads->Int32Value();
+    *dedicated = true;
+  }
+
+  if(!thread_name->IsUndefined()) {
+    if(!thread_name->IsString()) return "threadName must be a string";
+    // Linux allows 15 characters, keep room for the -<n> suffix
+    String::Utf8Value name(thread_name);
+    snprintf(options->name, 12, "%s", *name);
+    *dedicated = true;
+  }
+
+  if(!cpus->IsUndefined()) {
+    if(!cpus->IsArray()) return "cpus must be an array of cpu numbers";
+    Local<Array> list = Local<Array>::Cast(cpus);
+    if(list->Length() > ARRAY_SIZE(options->cpus)) return "cpus can list at most 64 cpus";
+
+    for(uint32_t i = 0; i < list->Length(); i++) {
+      Local<Value> cpu = list->Get(i);
+      if(!cpu->IsInt32() || cpu->Int32Value() < 0) return "cpus must be an array of cpu numbers";
+      options->cpus[i] = cpu->Int32Value();
+    }
+
+    options->cpu_count = list->Length();
+    *dedicated = true;
+  }
+
+  return NULL;
+}
+
 Handle<Value> Kerberos::New(const Arguments &args) {
+  HandleScope scope;
+  ThreadPoolOptions options;
+  bool dedicated = false;
+
+  ThreadPool::DefaultOptions(&options);
+
+  bool adaptive = false;
+  uint64_t inline_threshold = ADAPTIVE_THRESHOLD_US;
+  bool inline_cached = false;
+  uint32_t max_in_flight = 0;
+  int64_t max_queued = -1;
+  bool trace = false;
+  uint64_t trace_threshold = TRACE_THRESHOLD_MS;
+
+  // Unpack the pool options
+  if(args.Length() > 0 && args[0]->IsObject()) {
+    const char *message = ParseOptions(args[0]->ToObject(), &options, &dedicated);
+    if(message != NULL) return VException(message);
+
+    // Unpack the adaptive dispatch options
+    Local<Value> adaptive_value = args[0]->ToObject()->Get(String::NewSymbol("adaptive"));
+    Local<Value> threshold_value = args[0]->ToObject()->Get(String::NewSymbol("inlineThreshold"));
+    adaptive = adaptive_value->BooleanValue();
+
+    if(!threshold_value->IsUndefined()) {
+      if(!threshold_value->IsNumber() || threshold_value->NumberValue() < 0)
+        return VException("inlineThreshold must be a positive number of microseconds");
+      inline_threshold = (uint64_t)threshold_value->NumberValue();
+    }
+
+    // Cached ticket fast path, off unless asked for as its ccache lookup
+    // runs on the loop thread
+    Local<Value> inline_cached_value = args[0]->ToObject()->Get(String::NewSymbol("inlineCached"));
+    if(!inline_cached_value->IsUndefined()) inline_cached = inline_cached_value->BooleanValue();
+
+    // Unpack the admission control options
+    Local<Value> in_flight_value = args[0]->ToObject()->Get(String::NewSymbol("maxInFlight"));
+    Local<Value> queued_value = args[0]->ToObject()->Get(String::NewSymbol("maxQueued"));
+
+    if(!in_flight_value->IsUndefined()) {
+      if(!in_flight_value->IsUint32() || in_flight_value->Uint32Value() == 0)
+        return VException("maxInFlight must be a positive integer");
+      max_in_flight = in_flight_value->Uint32Value();
+    }
+
+    if(!queued_value->IsUndefined()) {
+      if(!queued_value->IsUint32()) return VException("maxQueued must be an integer of 0 or more");
+      max_queued = queued_value->Uint32Value();
+    }
+
+    // Unpack the trace options
+    Local<Value> trace_value = args[0]->ToObject()->Get(String::NewSymbol("trace"));
+    Local<Value> trace_threshold_value = args[0]->ToObject()->Get(String::NewSymbol("traceThreshold"));
+    trace = trace_value->BooleanValue();
+#ifndef KERBEROS_HAVE_TRACE
+    if(trace) return VException("trace needs MIT krb5 1.11 or later");
+#endif
+
+    if(!trace_threshold_value->IsUndefined()) {
+      if(!trace_threshold_value->IsNumber() || trace_threshold_value->NumberValue() < 0)
+        return VException("traceThreshold must be a positive number of milliseconds");
+      trace_threshold = (uint64_t)trace_threshold_value->NumberValue();
+    }
+  }
+
+  ThreadPool *pool = NULL;
+
+  if(dedicated) {
+    pool = new ThreadPool(uv_default_loop(), &options, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+  } else {
+    // Started on first use and kept for the life of the process
+    if(default_pool == NULL) {
+      default_pool = new ThreadPool(uv_default_loop(), &options, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+    }
+
+    pool = default_pool;
+  }
+
   // Create a Kerberos instance
-  Kerberos *kerberos = new Kerberos();
+  Kerberos *kerberos = new Kerberos(pool, dedicated);
+  kerberos->adaptive = adaptive;
+  kerberos->inline_threshold = inline_threshold * 1000;
+  kerberos->inline_cached = inline_cached;
+  kerberos->max_in_flight = max_in_flight;
+  kerberos->max_queued = max_queued;
+  kerberos->trace = trace;
+  kerberos->trace_threshold = trace_threshold * 1000000;
   // Return the kerberos object
   kerberos->Wrap(args.This());
   return args.This();
 }
 
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-// authGSSClientInit
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSClientInit(Worker *worker) {
-  gss_client_state *state;
-  gss_response *response;
+// Hand an operation to our pool, it comes back through Process and After.
+// Operations on a context wait for the ones ahead of them to complete.
+Handle<Value> Kerberos::Queue(Operation *operation, Handle<Function> callback) {
+  HandleScope scope;
+  operation->callback = Persistent<Function>::New(callback);
+
+  if(!Schedule(operation)) return scope.Close(Number::New(operation->id));
+
+  // Operations that don't need the KDC, or wraps and unwraps that usually
+  // finish faster than the trip to the pool, run right here. The callback
+  // still comes on a later loop iteration.
+  ExecuteEstimate *estimate = operation->Estimate();
+  if(inline_cached && operation->RunCached()) {
+    Stats::RecordInline();
+    pool->Deliver(operation);
+  } else if(adaptive && operation->Adaptive() && estimate->samples >= ADAPTIVE_MIN_SAMPLES && estimate->average < inline_threshold) {
+    operation->Run();
+    Stats::RecordInline();
+    pool->Deliver(operation);
+  } else {
+    Dispatch(operation);
+  }
+
+  return scope.Close(Number::New(operation->id));
+}
 
-  // Allocate state
-  state = (gss_client_state *)malloc(sizeof(gss_client_state));
-  if(state == NULL) die("Memory allocation failed");
+// Queue a list of operations linked through next that call back once with
+// all their results. Whatever can run goes to the pool in one submission.
+Handle<Value> Kerberos::QueueBatch(Operation *operations, uint32_t count, Handle<Function> callback) {
+  HandleScope scope;
+  OperationBatch *batch = new OperationBatch(count, callback);
+  Local<Array> ids = Array::New(count);
+  Operation *head = NULL;
+  Operation *tail = NULL;
+  uint32_t index = 0;
+
+  while(operations != NULL) {
+    Operation *operation = operations;
+    operations = operation->next;
+    operation->next = NULL;
+
+    operation->batch = batch;
+    operation->batch_index = index++;
+
+    bool runnable = Schedule(operation);
+    ids->Set(operation->batch_index, Number::New(operation->id));
+
+    if(runnable && TakeSlot(operation)) {
+      if(tail == NULL) {
+        head = operation;
+      } else {
+        tail->next = operation;
+      }
+      tail = operation;
+    }
+  }
 
-  // Unpack the parameter data struct
-  AuthGSSClientCall *call = (AuthGSSClientCall *)worker->parameters;
-  // Start the kerberos client
-  response = authenticate_gss_client_init(call->uri, call->flags, state);
+  if(head != NULL) pool->Submit(head);
+  return scope.Close(ids);
+}
 
-  // Release the parameter struct memory
-  free(call->uri);
-  free(call);
+bool Kerberos::Schedule(Operation *operation) {
+  operation->owner = this;
+  operation->id = ++last_id;
+  operation->queued_at = uv_hrtime();
+  KERBEROS_PROBE3(queue, operation->Type(), operation->id, operation->context);
+  // Keep the instance and with it the pool alive until we called back
+  Ref();
+
+  // Track it so cancel can find it
+  operation->pending_prev = NULL;
+  operation->pending_next = pending_head;
+  if(pending_head != NULL) pending_head->pending_prev = operation;
+  pending_head = operation;
+
+  // Shed load here rather than let work pile up behind a full queue
+  bool waits = (operation->context != NULL && operation->context->IsBusy())
+    || (max_in_flight > 0 && in_flight >= max_in_flight);
+
+  if(waits && max_queued >= 0 && queued >= max_queued) {
+    operation->context = NULL;
+    operation->Fail(OPERATION_OVERLOADED, "Too many queued operations");
+    pool->Deliver(operation);
+    return false;
+  }
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-    free(state);
+  if(operation->context == NULL || operation->context->Schedule(operation)) return true;
+
+  // Waiting behind another operation on the context
+  queued++;
+  return false;
+}
+
+void Kerberos::Dispatch(Operation *operation) {
+  Kerberos *owner = operation->owner;
+
+  // Schedule the operation on the pool of the instance that queued it
+  if(owner->TakeSlot(operation)) {
+    owner->pool->Submit(operation);
+  }
+}
+
+bool Kerberos::TakeSlot(Operation *operation) {
+  operation->next = NULL;
+
+  if(max_in_flight > 0 && in_flight >= max_in_flight) {
+    // Wait for one of ours to call back
+    if(waiting_tail == NULL) {
+      waiting_head = operation;
+    } else {
+      waiting_tail->next = operation;
+    }
+    waiting_tail = operation;
+    queued++;
+    return false;
+  }
+
+  in_flight++;
+  operation->dispatched = true;
+  KERBEROS_PROBE3(dispatch, operation->Type(), operation->id, operation->context);
+  return true;
+}
+
+bool Kerberos::RemoveWaiting(Operation *operation) {
+  Operation *previous = NULL;
+
+  for(Operation *current = waiting_head; current != NULL; current = current->next) {
+    if(current != operation) {
+      previous = current;
+      continue;
+    }
+
+    // Unlink it
+    if(previous == NULL) {
+      waiting_head = current->next;
+    } else {
+      previous->next = current->next;
+    }
+    if(waiting_tail == current) waiting_tail = previous;
+    current->next = NULL;
+    queued--;
+    return true;
+  }
+
+  return false;
+}
+
+// Queue depth method
+Handle<Value> Kerberos::QueueDepth(const Arguments &args) {
+  HandleScope scope;
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  return scope.Close(Uint32::New(kerberos->queued));
+}
+
+// In flight method
+Handle<Value> Kerberos::InFlight(const Arguments &args) {
+  HandleScope scope;
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  return scope.Close(Uint32::New(kerberos->in_flight));
+}
+
+// Cancel method
+Handle<Value> Kerberos::Cancel(const Arguments &args) {
+  HandleScope scope;
+
+  // Ensure valid call
+  if(args.Length() != 1 || !args[0]->IsNumber()) return VException("Requires an operation id");
+
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  uint32_t id = args[0]->Uint32Value();
+  Operation *operation = kerberos->pending_head;
+
+  while(operation != NULL && operation->id != id) {
+    operation = operation->pending_next;
+  }
+
+  // Already called back
+  if(operation == NULL) return scope.Close(False());
+
+  // Still waiting behind another operation on its context, it no longer
+  // holds the context so After must not complete it there
+  if(operation->context != NULL && operation->context->Remove(operation)) {
+    kerberos->queued--;
+    operation->context = NULL;
+    operation->Fail(OPERATION_CANCELLED, "Operation was cancelled");
+    kerberos->pool->Deliver(operation);
+    return scope.Close(True());
+  }
+
+  // Still waiting for an in flight slot, it does hold its context
+  if(kerberos->RemoveWaiting(operation)) {
+    operation->Fail(OPERATION_CANCELLED, "Operation was cancelled");
+    kerberos->pool->Deliver(operation);
+    return scope.Close(True());
+  }
+
+  // Still waiting for a worker
+  if(kerberos->pool->Cancel(operation)) {
+    operation->Fail(OPERATION_CANCELLED, "Operation was cancelled");
+    return scope.Close(True());
+  }
+
+  // Running or done, it calls back with its result
+  return scope.Close(False());
+}
+
+Handle<Value> Kerberos::RunSync(Operation *operation) {
+  HandleScope scope;
+  Handle<Value> result;
+
+  operation->Run();
+  operation->Estimate()->Add(operation->execute_time);
+
+  // If we have an error throw it
+  if(operation->error) {
+    Stats::RecordError(operation);
+    Local<Value> err = Exception::Error(String::New(operation->error_message));
+    err->ToObject()->Set(NODE_PSYMBOL("code"), Int32::New(operation->error_code));
+    result = ThrowException(err);
   } else {
-    worker->return_value = state;
+    result = operation->Map();
   }
 
-  // Free structure
-  free(response);
+  // Hand the operation back to its pool
+  operation->Release();
+  return scope.Close(result);
 }
 
-static Handle<Value> _map_authGSSClientInit(Worker *worker) {
+// Check the arguments of a batch call, a non empty array of { context,
+// challenge } objects and a callback function
+static bool IsBatch(const Arguments &args, bool requires_challenge) {
   HandleScope scope;
 
-  KerberosContext *context = KerberosContext::New();
-  context->client_state = (gss_client_state *)worker->return_value;
-  // Persistent<Value> _context = Persistent<Value>::New(context->handle_);
-  return scope.Close(context->handle_);
+  if(args.Length() != 2 || !args[0]->IsArray() || !args[1]->IsFunction()) return false;
+
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  if(items->Length() == 0) return false;
+
+  for(uint32_t i = 0; i < items->Length(); i++) {
+    Local<Value> item = items->Get(i);
+    if(!item->IsObject()) return false;
+
+    Local<Object> object = item->ToObject();
+    if(!KerberosContext::HasInstance(object->Get(String::NewSymbol("context")))) return false;
+
+    Local<Value> challenge = object->Get(String::NewSymbol("challenge"));
+    if(challenge->IsUndefined() && !requires_challenge) continue;
+    if(!IsChallenge(challenge)) return false;
+  }
+
+  return true;
+}
+
+// Mechanism from the mech init option, 'krb5' or 'spnego'. Returns an error
+// message for anything else.
+static const char *ParseMech(Handle<Object> options, int *mech) {
+  Local<Value> value = options->Get(String::NewSymbol("mech"));
+  *mech = AUTH_GSS_MECH_DEFAULT;
+
+  if(value->IsUndefined() || value->IsNull()) return NULL;
+  if(!value->IsString()) return "mech must be 'krb5' or 'spnego'";
+
+  String::Utf8Value name(value->ToString());
+  if(strcmp(*name, "krb5") == 0) {
+    *mech = AUTH_GSS_MECH_KRB5;
+  } else if(strcmp(*name, "spnego") == 0) {
+    *mech = AUTH_GSS_MECH_SPNEGO;
+  } else {
+    return "mech must be 'krb5' or 'spnego'";
+  }
+
+  return NULL;
 }
 
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// authGSSClientInit
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class ClientInitOperation : public PooledOperation<ClientInitOperation> {
+  public:
+    static const OperationType kType = OPERATION_CLIENT_INIT;
+
+    ClientInitOperation() : flags(0), mech(AUTH_GSS_MECH_DEFAULT), cred(NULL), state(NULL), context_id(0), trace(false), trace_threshold(0), record(NULL) {}
+
+    void Execute() {
+      // Fetch the ticket ourselves so the KDC traffic shows up. Shared
+      // credentials are traced when we can reach their ccache, password
+      // ones keep it inside GSS.
+#ifdef KERBEROS_HAVE_TRACE
+      if(trace) {
+        char *ccache_name = cred != NULL ? authenticate_gss_cred_ccache_name(cred) : NULL;
+
+        if(cred == NULL || ccache_name != NULL) {
+          record = (TraceRecord *)malloc(sizeof(TraceRecord));
+          if(record == NULL) die("Memory allocation failed");
+          Trace::Fetch((const char *)uri.data, ccache_name, record);
+          record->context_id = context_id;
+          Trace::Retain(record, trace_threshold);
+        }
+        free(ccache_name);
+      }
+#endif
+
+      // Allocate state
+      state = (gss_client_state *)malloc(sizeof(gss_client_state));
+      if(state == NULL) die("Memory allocation failed");
+
+      // Start the kerberos client
+      SetResult(this, authenticate_gss_client_init((const char *)uri.data, flags, mech, cred, state));
+
+      if(error) {
+        free(state);
+        state = NULL;
+        free(record);
+        record = NULL;
+      }
+    }
+
+    Handle<Value> Map() {
+      HandleScope scope;
+
+      KerberosContext *context = KerberosContext::New();
+      context->client_state = state;
+      context->id = context_id;
+      context->trace = record;
+      return scope.Close(context->handle_);
+    }
+
+    void Reset() {
+      // The state took its own reference if init got that far
+      if(cred != NULL) authenticate_gss_cred_release(cred);
+      cred = NULL;
+      state = NULL;
+      record = NULL;
+      mech = AUTH_GSS_MECH_DEFAULT;
+    }
+
+    OperationBuffer uri;
+    uint32_t flags;
+    // AUTH_GSS_MECH_* to initiate with
+    int mech;
+    // Credentials to initiate with, NULL for the default ccache
+    gss_client_cred *cred;
+    gss_client_state *state;
+    uint32_t context_id;
+    bool trace;
+    uint64_t trace_threshold;
+    TraceRecord *record;
+};
+
 // Initialize method
 Handle<Value> Kerberos::AuthGSSClientInit(const Arguments &args) {
   HandleScope scope;
 
   // Ensure valid call
-  if(args.Length() != 3) return VException("Requires a service string uri, integer flags and a callback function");
+  if(args.Length() != 3 && args.Length() != 4) return VException("Requires a service string uri, integer flags, optional options object and a callback function");
   if(args.Length() == 3 && !args[0]->IsString() && !args[1]->IsInt32() && !args[2]->IsFunction())
-      return VException("Requires a service string uri, integer flags and a callback function");
+      return VException("Requires a service string uri, integer flags, optional options object and a callback function");
+  if(args.Length() == 4 && (!args[2]->IsObject() || !args[3]->IsFunction()))
+      return VException("Requires a service string uri, integer flags, optional options object and a callback function");
 
-  Local<String> service = args[0]->ToString();
-  // Convert uri string to c-string
-  char *service_str = (char *)calloc(service->Utf8Length() + 1, sizeof(char));
-  if(service_str == NULL) die("Memory allocation failed");
+  // Initiate with shared credentials instead of the default ccache
+  KerberosCredential *credential = NULL;
+  int mech = AUTH_GSS_MECH_DEFAULT;
+  if(args.Length() == 4) {
+    Local<Value> value = args[2]->ToObject()->Get(String::NewSymbol("credential"));
 
-  // Write v8 string to c-string
-  service->WriteUtf8(service_str);
+    if(KerberosCredential::HasInstance(value)) {
+      credential = ObjectWrap::Unwrap<KerberosCredential>(value->ToObject());
+    } else if(!value->IsUndefined() && !value->IsNull()) {
+      return VException("credential must be a KerberosCredential");
+    }
 
-  // Allocate a structure
-  AuthGSSClientCall *call = (AuthGSSClientCall *)calloc(1, sizeof(AuthGSSClientCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->flags =args[1]->ToInt32()->Uint32Value();
-  call->uri = service_str;
+    const char *message = ParseMech(args[2]->ToObject(), &mech);
+    if(message != NULL) return VException(message);
+  }
 
-  // Unpack the callback
-  Local<Function> callback = Local<Function>::Cast(args[2]);
-
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSClientInit;
-  worker->mapper = _map_authGSSClientInit;
-
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
-  // Return no value as it's callback based
+  // Unpack the arguments into a recycled operation
+  ClientInitOperation *operation = ClientInitOperation::Acquire();
+  operation->uri.CopyString(args[0]->ToString());
+  operation->flags = args[1]->ToInt32()->Uint32Value();
+  operation->mech = mech;
+  operation->context_id = KerberosContext::NextId();
+
+  // Hold the credentials until init has taken them, the js object may go first
+  if(credential != NULL && credential->cred != NULL) {
+    authenticate_gss_cred_retain(credential->cred);
+    operation->cred = credential->cred;
+  }
+
+  // Trace the ticket fetch if asked to
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  operation->trace = kerberos->trace;
+  operation->trace_threshold = kerberos->trace_threshold;
+
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[args.Length() - 1])));
+}
+
+// Forget the interned service names, e.g. after a DNS change
+Handle<Value> Kerberos::ClearServiceNames(const Arguments &args) {
+  HandleScope scope;
+  authenticate_gss_client_clear_names();
   return scope.Close(Undefined());
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-// authGSSClientStep
+// acquireCredential
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSClientStep(Worker *worker) {
-  gss_client_state *state;
-  gss_response *response;
-  char *challenge;
+class CredentialAcquireOperation : public PooledOperation<CredentialAcquireOperation> {
+  public:
+    static const OperationType kType = OPERATION_CREDENTIAL_ACQUIRE;
+
+    CredentialAcquireOperation() : has_principal(false), has_password(false), has_keytab(false), has_snapshot(false), has_shared(false), cred(NULL) {}
+
+    void Execute() {
+      if(has_keytab) {
+        SetResult(this, authenticate_gss_cred_login((const char *)principal.data, (const char *)keytab.data,
+          has_snapshot ? (const char *)snapshot.data : NULL,
+          has_shared ? (const char *)shared.data : NULL,
+          has_shared ? (const char *)lock_dir.data : NULL, &cred));
+        return;
+      }
+
+      SetResult(this, authenticate_gss_cred_acquire(has_principal ? (const char *)principal.data : NULL,
+        has_password ? (const char *)password.data : NULL, &cred));
+
+      // Don't leave the password lying around in a recycled buffer
+      if(has_password) memset(password.data, 0, password.length);
+    }
 
-  // Unpack the parameter data struct
-  AuthGSSClientStepCall *call = (AuthGSSClientStepCall *)worker->parameters;
-  // Get the state
-  state = call->context->client_state;
-  challenge = call->challenge;
+    Handle<Value> Map() {
+      HandleScope scope;
 
-  // Check what kind of challenge we have
-  if(call->challenge == NULL) {
-    challenge = (char *)"";
-  }
+      KerberosCredential *credential = KerberosCredential::New();
+      credential->cred = cred;
+      cred = NULL;
+      return scope.Close(credential->handle_);
+    }
 
-  // Perform authentication step
-  response = authenticate_gss_client_step(state, challenge);
+    void Reset() {
+      // Only left over when the result was never mapped
+      if(cred != NULL) authenticate_gss_cred_release(cred);
+      cred = NULL;
+      has_principal = false;
+      has_password = false;
+      has_keytab = false;
+      has_snapshot = false;
+      has_shared = false;
+    }
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-  } else {
-    worker->return_code = response->return_code;
+    OperationBuffer principal;
+    OperationBuffer password;
+    // Client keytab to log in from instead of the ccache
+    OperationBuffer keytab;
+    // Ticket snapshot of an earlier process to start the login from
+    OperationBuffer snapshot;
+    // Ccache shared with other processes and the directory of its locks
+    OperationBuffer shared;
+    OperationBuffer lock_dir;
+    bool has_principal;
+    bool has_password;
+    bool has_keytab;
+    bool has_snapshot;
+    bool has_shared;
+    gss_client_cred *cred;
+};
+
+// Initialize method
+Handle<Value> Kerberos::AcquireCredential(const Arguments &args) {
+  HandleScope scope;
+
+  // Ensure valid call
+  if(args.Length() != 7 || !args[6]->IsFunction()
+    || !(args[0]->IsString() || args[0]->IsNull() || args[0]->IsUndefined())
+    || !(args[1]->IsString() || args[1]->IsNull() || args[1]->IsUndefined())
+    || !(args[2]->IsString() || args[2]->IsNull() || args[2]->IsUndefined())
+    || !(args[3]->IsString() || args[3]->IsNull() || args[3]->IsUndefined())
+    || !(args[4]->IsString() || args[4]->IsNull() || args[4]->IsUndefined())
+    || !(args[5]->IsString() || args[5]->IsNull() || args[5]->IsUndefined()))
+      return VException("Requires an optional principal string, optional password string, optional keytab string, optional snapshot path, optional shared ccache name, optional lock directory and a callback function");
+  if(args[2]->IsString() && (!args[0]->IsString() || args[1]->IsString()))
+      return VException("A keytab login requires a principal and no password");
+  if(args[3]->IsString() && !args[2]->IsString())
+      return VException("Only a keytab login can start from a ticket snapshot");
+  if(args[4]->IsString() && (!args[2]->IsString() || !args[5]->IsString()))
+      return VException("A shared ccache needs a keytab login and a lock directory");
+  if(args[3]->IsString() && args[4]->IsString())
+      return VException("A shared ccache can't start from a ticket snapshot");
+
+  // Unpack the arguments into a recycled operation
+  CredentialAcquireOperation *operation = CredentialAcquireOperation::Acquire();
+  if(args[0]->IsString()) {
+    operation->principal.CopyString(args[0]->ToString());
+    operation->has_principal = true;
+  }
+  if(args[1]->IsString()) {
+    operation->password.CopyString(args[1]->ToString());
+    operation->has_password = true;
+  }
+  if(args[2]->IsString()) {
+    operation->keytab.CopyString(args[2]->ToString());
+    operation->has_keytab = true;
+  }
+  if(args[3]->IsString()) {
+    operation->snapshot.CopyString(args[3]->ToString());
+    operation->has_snapshot = true;
+  }
+  if(args[4]->IsString()) {
+    operation->shared.CopyString(args[4]->ToString());
+    operation->lock_dir.CopyString(args[5]->ToString());
+    operation->has_shared = true;
   }
 
-  // Free up structure
-  if(call->challenge != NULL) free(call->challenge);
-  free(call);
-  free(response);
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[6])));
+}
+
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Credential refresh, armed through KerberosCredential.renewIn
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class CredentialRefreshOperation : public PooledOperation<CredentialRefreshOperation> {
+  public:
+    static const OperationType kType = OPERATION_CREDENTIAL_REFRESH;
+
+    CredentialRefreshOperation() : cred(NULL) {}
+
+    void Execute() {
+      SetResult(this, authenticate_gss_cred_refresh(cred));
+    }
+
+    Handle<Value> Map() {
+      HandleScope scope;
+      time_t obtained;
+      time_t expires;
+
+      // The new expiry, null for never
+      authenticate_gss_cred_times(cred, &obtained, &expires);
+      if(expires == 0) return scope.Close(Null());
+      return scope.Close(Number::New(expires * 1000.0));
+    }
+
+    void Reset() {
+      if(cred != NULL) authenticate_gss_cred_release(cred);
+      cred = NULL;
+    }
+
+    gss_client_cred *cred;
+};
+
+Handle<Value> Kerberos::QueueRefresh(KerberosCredential *credential, Handle<Function> callback) {
+  HandleScope scope;
+
+  // The operation holds the credentials, the js object may go first
+  CredentialRefreshOperation *operation = CredentialRefreshOperation::Acquire();
+  authenticate_gss_cred_retain(credential->cred);
+  operation->cred = credential->cred;
+
+  return scope.Close(Queue(operation, callback));
 }
 
-static Handle<Value> _map_authGSSClientStep(Worker *worker) {
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// prefetch
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class PrefetchOperation : public PooledOperation<PrefetchOperation> {
+  public:
+    static const OperationType kType = OPERATION_CLIENT_PREFETCH;
+
+    PrefetchOperation() : cred(NULL), failure(NULL), failure_code(0) {}
+
+    void Execute() {
+      SetResult(this, authenticate_gss_client_prefetch((const char *)service.data, cred));
+
+      // A failed fetch is a result like any other, so every service gets
+      // its timing. Count it here as After won't see it.
+      if(error) {
+        Stats::RecordError(this);
+        failure = error_message;
+        failure_code = error_code;
+        error = false;
+        error_message = NULL;
+      }
+    }
+
+    // { service, duration, error }, duration in ms, error null on success
+    Handle<Value> Map() {
+      HandleScope scope;
+      Local<Object> result = Object::New();
+
+      result->Set(String::NewSymbol("service"), String::New((const char *)service.data, service.length));
+      result->Set(String::NewSymbol("duration"), Number::New(execute_time / 1e6));
+
+      if(failure != NULL) {
+        Local<Value> err = Exception::Error(String::New(failure));
+        err->ToObject()->Set(NODE_PSYMBOL("code"), Int32::New(failure_code));
+        result->Set(String::NewSymbol("error"), err);
+      } else {
+        result->Set(String::NewSymbol("error"), Null());
+      }
+
+      return scope.Close(result);
+    }
+
+    void Reset() {
+      if(cred != NULL) authenticate_gss_cred_release(cred);
+      cred = NULL;
+      failure = NULL;
+      failure_code = 0;
+    }
+
+    OperationBuffer service;
+    // Credentials whose ccache to fill, NULL for the default one
+    gss_client_cred *cred;
+    char *failure;
+    int failure_code;
+};
+
+// Batch method
+Handle<Value> Kerberos::Prefetch(const Arguments &args) {
   HandleScope scope;
-  // Return the return code
-  return scope.Close(Int32::New(worker->return_code));
+
+  // Ensure valid call
+  if(args.Length() != 3 || !args[0]->IsArray() || Local<Array>::Cast(args[0])->Length() == 0
+    || !(args[1]->IsNull() || args[1]->IsUndefined() || KerberosCredential::HasInstance(args[1]))
+    || !args[2]->IsFunction())
+      return VException("Requires an array of service strings, an optional KerberosCredential and a callback function");
+
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  for(uint32_t i = 0; i < items->Length(); i++) {
+    if(!items->Get(i)->IsString()) return VException("Requires an array of service strings, an optional KerberosCredential and a callback function");
+  }
+
+  gss_client_cred *cred = NULL;
+  if(KerberosCredential::HasInstance(args[1])) {
+    cred = ObjectWrap::Unwrap<KerberosCredential>(args[1]->ToObject())->cred;
+  }
+
+  Operation *operations = NULL;
+
+  // Unpack the items into operations, last first to keep the order
+  for(uint32_t i = items->Length(); i-- > 0;) {
+    PrefetchOperation *operation = PrefetchOperation::Acquire();
+    operation->service.CopyString(items->Get(i)->ToString());
+
+    if(cred != NULL) {
+      authenticate_gss_cred_retain(cred);
+      operation->cred = cred;
+    }
+
+    operation->next = operations;
+    operations = operation;
+  }
+
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation ids, they can be passed to cancel
+  return scope.Close(kerberos->QueueBatch(operations, items->Length(), Local<Function>::Cast(args[2])));
 }
 
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// authGSSClientStep
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class ClientStepOperation : public PooledOperation<ClientStepOperation> {
+  public:
+    static const OperationType kType = OPERATION_CLIENT_STEP;
+
+    void Execute() {
+      gss_client_state *state = context->client_state;
+      // Perform authentication step
+      state->response_format = challenge.response_format;
+      SetResult(this, authenticate_gss_client_step(state, challenge.token.data, challenge.token.length));
+
+      // Count the token bytes
+      token_in = challenge.token.length;
+      token_out = ResponseLength(state->response, &state->response_token);
+    }
+
+    // Later legs and first legs with the service ticket in the ccache only
+    // do local crypto, a first leg that would fetch goes to the pool
+    bool ExecuteCached() {
+      gss_client_state *state = context->client_state;
+      state->response_format = challenge.response_format;
+      gss_response *response = authenticate_gss_client_step_cached(state, challenge.token.data, challenge.token.length);
+      if(response == NULL) return false;
+
+      SetResult(this, response);
+      token_in = challenge.token.length;
+      token_out = ResponseLength(state->response, &state->response_token);
+      return true;
+    }
+
+    void Reset() {
+      challenge.Reset();
+    }
+
+    ChallengeArgs challenge;
+};
+
 // Initialize method
 Handle<Value> Kerberos::AuthGSSClientStep(const Arguments &args) {
   HandleScope scope;
@@ -234,89 +1027,79 @@ Handle<Value> Kerberos::AuthGSSClientStep(const Arguments &args) {
   // Ensure valid call
   if(args.Length() != 2 && args.Length() != 3) return VException("Requires a GSS context, optional challenge string and callback function");
   if(args.Length() == 2 && !KerberosContext::HasInstance(args[0])) return VException("Requires a GSS context, optional challenge string and callback function");
-  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !args[1]->IsString()) return VException("Requires a GSS context, optional challenge string and callback function");
+  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !IsChallenge(args[1])) return VException("Requires a GSS context, optional challenge string and callback function");
 
-  // Challenge string
-  char *challenge_str = NULL;
   // Let's unpack the parameters
-  Local<Object> object = args[0]->ToObject();
-  KerberosContext *kerberos_context = KerberosContext::Unwrap<KerberosContext>(object);
+  ClientStepOperation *operation = ClientStepOperation::Acquire();
+  operation->context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
 
-  // If we have a challenge string
+  // If we have a challenge decode or copy it straight into the operation
   if(args.Length() == 3) {
-    // Unpack the challenge string
-    Local<String> challenge = args[1]->ToString();
-    // Convert uri string to c-string
-    challenge_str = (char *)calloc(challenge->Utf8Length() + 1, sizeof(char));
-    if(challenge_str == NULL) die("Memory allocation failed");
-    // Write v8 string to c-string
-    challenge->WriteUtf8(challenge_str);
+    operation->challenge.Set(args[1]);
   }
 
-  // Allocate a structure
-  AuthGSSClientStepCall *call = (AuthGSSClientStepCall *)calloc(1, sizeof(AuthGSSClientCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->context = kerberos_context;
-  call->challenge = challenge_str;
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[2])));
+}
 
-  // Unpack the callback
-  Local<Function> callback = Local<Function>::Cast(args[2]);
+// Batch method
+Handle<Value> Kerberos::AuthGSSClientStepMany(const Arguments &args) {
+  HandleScope scope;
 
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSClientStep;
-  worker->mapper = _map_authGSSClientStep;
+  // Ensure valid call
+  if(!IsBatch(args, false)) return VException("Requires an array of { context, challenge } objects and a callback function");
 
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  Operation *operations = NULL;
 
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
+  // Unpack the items into operations, last first to keep the order
+  for(uint32_t i = items->Length(); i-- > 0;) {
+    Local<Object> item = items->Get(i)->ToObject();
+    ClientStepOperation *operation = ClientStepOperation::Acquire();
+    operation->context = KerberosContext::Unwrap<KerberosContext>(item->Get(String::NewSymbol("context"))->ToObject());
+
+    Local<Value> challenge = item->Get(String::NewSymbol("challenge"));
+    if(!challenge->IsUndefined()) operation->challenge.Set(challenge);
+
+    operation->next = operations;
+    operations = operation;
+  }
+
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation ids, they can be passed to cancel
+  return scope.Close(kerberos->QueueBatch(operations, items->Length(), Local<Function>::Cast(args[1])));
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // authGSSClientUnwrap
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSClientUnwrap(Worker *worker) {
-  gss_response *response;
-  char *challenge;
-
-  // Unpack the parameter data struct
-  AuthGSSClientUnwrapCall *call = (AuthGSSClientUnwrapCall *)worker->parameters;
-  challenge = call->challenge;
-
-  // Check what kind of challenge we have
-  if(call->challenge == NULL) {
-    challenge = (char *)"";
-  }
-
-  // Perform authentication step
-  response = authenticate_gss_client_unwrap(call->context->client_state, challenge);
+class ClientUnwrapOperation : public PooledOperation<ClientUnwrapOperation> {
+  public:
+    static const OperationType kType = OPERATION_CLIENT_UNWRAP;
+
+    void Execute() {
+      gss_client_state *state = context->client_state;
+      // Perform authentication step
+      state->response_format = challenge.response_format;
+      SetResult(this, authenticate_gss_client_unwrap(state, challenge.token.data, challenge.token.length));
+
+      // Count the token bytes
+      token_in = challenge.token.length;
+      token_out = ResponseLength(state->response, &state->response_token);
+    }
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-  } else {
-    worker->return_code = response->return_code;
-  }
+    // Local crypto on an established context
+    bool Adaptive() {
+      return true;
+    }
 
-  // Free up structure
-  if(call->challenge != NULL) free(call->challenge);
-  free(call);
-  free(response);
-}
+    void Reset() {
+      challenge.Reset();
+    }
 
-static Handle<Value> _map_authGSSClientUnwrap(Worker *worker) {
-  HandleScope scope;
-  // Return the return code
-  return scope.Close(Int32::New(worker->return_code));
-}
+    ChallengeArgs challenge;
+};
 
 // Initialize method
 Handle<Value> Kerberos::AuthGSSClientUnwrap(const Arguments &args) {
@@ -325,90 +1108,115 @@ Handle<Value> Kerberos::AuthGSSClientUnwrap(const Arguments &args) {
   // Ensure valid call
   if(args.Length() != 2 && args.Length() != 3) return VException("Requires a GSS context, optional challenge string and callback function");
   if(args.Length() == 2 && !KerberosContext::HasInstance(args[0]) && !args[1]->IsFunction()) return VException("Requires a GSS context, optional challenge string and callback function");
-  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !args[1]->IsString() && !args[2]->IsFunction()) return VException("Requires a GSS context, optional challenge string and callback function");
+  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !IsChallenge(args[1]) && !args[2]->IsFunction()) return VException("Requires a GSS context, optional challenge string and callback function");
 
-  // Challenge string
-  char *challenge_str = NULL;
   // Let's unpack the parameters
-  Local<Object> object = args[0]->ToObject();
-  KerberosContext *kerberos_context = KerberosContext::Unwrap<KerberosContext>(object);
+  ClientUnwrapOperation *operation = ClientUnwrapOperation::Acquire();
+  operation->context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
 
-  // If we have a challenge string
+  // If we have a challenge decode or copy it straight into the operation
   if(args.Length() == 3) {
-    // Unpack the challenge string
-    Local<String> challenge = args[1]->ToString();
-    // Convert uri string to c-string
-    challenge_str = (char *)calloc(challenge->Utf8Length() + 1, sizeof(char));
-    if(challenge_str == NULL) die("Memory allocation failed");
-    // Write v8 string to c-string
-    challenge->WriteUtf8(challenge_str);
+    operation->challenge.Set(args[1]);
   }
 
-  // Allocate a structure
-  AuthGSSClientUnwrapCall *call = (AuthGSSClientUnwrapCall *)calloc(1, sizeof(AuthGSSClientUnwrapCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->context = kerberos_context;
-  call->challenge = challenge_str;
-
   // Unpack the callback
   Local<Function> callback = args.Length() == 3 ? Local<Function>::Cast(args[2]) : Local<Function>::Cast(args[1]);
 
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSClientUnwrap;
-  worker->mapper = _map_authGSSClientUnwrap;
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, callback));
+}
 
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+// Batch method
+Handle<Value> Kerberos::AuthGSSClientUnwrapMany(const Arguments &args) {
+  HandleScope scope;
 
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
+  // Ensure valid call
+  if(!IsBatch(args, false)) return VException("Requires an array of { context, challenge } objects and a callback function");
+
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  Operation *operations = NULL;
+
+  // Unpack the items into operations, last first to keep the order
+  for(uint32_t i = items->Length(); i-- > 0;) {
+    Local<Object> item = items->Get(i)->ToObject();
+    ClientUnwrapOperation *operation = ClientUnwrapOperation::Acquire();
+    operation->context = KerberosContext::Unwrap<KerberosContext>(item->Get(String::NewSymbol("context"))->ToObject());
+
+    Local<Value> challenge = item->Get(String::NewSymbol("challenge"));
+    if(!challenge->IsUndefined()) operation->challenge.Set(challenge);
+
+    operation->next = operations;
+    operations = operation;
+  }
+
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation ids, they can be passed to cancel
+  return scope.Close(kerberos->QueueBatch(operations, items->Length(), Local<Function>::Cast(args[1])));
+}
+
+// Sync method
+Handle<Value> Kerberos::AuthGSSClientUnwrapSync(const Arguments &args) {
+  HandleScope scope;
+
+  // Ensure valid call
+  if(args.Length() != 1 && args.Length() != 2) return VException("Requires a GSS context and optional challenge string");
+  if(!KerberosContext::HasInstance(args[0])) return VException("Requires a GSS context and optional challenge string");
+  if(args.Length() == 2 && !IsChallenge(args[1])) return VException("Requires a GSS context and optional challenge string");
+
+  // The context can't be used while an async call is running on it
+  KerberosContext *context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
+  if(context->IsBusy()) return VException("GSS context has pending operations");
+
+  // Let's unpack the parameters
+  ClientUnwrapOperation *operation = ClientUnwrapOperation::Acquire();
+  operation->context = context;
+
+  // If we have a challenge decode or copy it straight into the operation
+  if(args.Length() == 2) {
+    operation->challenge.Set(args[1]);
+  }
+
+  return scope.Close(RunSync(operation));
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // authGSSClientWrap
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSClientWrap(Worker *worker) {
-  gss_response *response;
-  char *user_name = NULL;
+class ClientWrapOperation : public PooledOperation<ClientWrapOperation> {
+  public:
+    static const OperationType kType = OPERATION_CLIENT_WRAP;
 
-  // Unpack the parameter data struct
-  AuthGSSClientWrapCall *call = (AuthGSSClientWrapCall *)worker->parameters;
-  user_name = call->user_name;
+    ClientWrapOperation() : has_user_name(false) {}
 
-  // Check what kind of challenge we have
-  if(call->user_name == NULL) {
-    user_name = (char *)"";
-  }
+    void Execute() {
+      gss_client_state *state = context->client_state;
+      // Check what kind of user name we have
+      const char *user = has_user_name ? (const char *)user_name.data : "";
 
-  // Perform authentication step
-  response = authenticate_gss_client_wrap(call->context->client_state, call->challenge, user_name);
+      // Perform authentication step
+      state->response_format = challenge.response_format;
+      SetResult(this, authenticate_gss_client_wrap(state, challenge.token.data, challenge.token.length, user));
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-  } else {
-    worker->return_code = response->return_code;
-  }
+      // Count the token bytes
+      token_in = challenge.token.length;
+      token_out = ResponseLength(state->response, &state->response_token);
+    }
 
-  // Free up structure
-  if(call->challenge != NULL) free(call->challenge);
-  if(call->user_name != NULL) free(call->user_name);
-  free(call);
-  free(response);
-}
+    // Local crypto on an established context
+    bool Adaptive() {
+      return true;
+    }
 
-static Handle<Value> _map_authGSSClientWrap(Worker *worker) {
-  HandleScope scope;
-  // Return the return code
-  return scope.Close(Int32::New(worker->return_code));
-}
+    void Reset() {
+      challenge.Reset();
+      has_user_name = false;
+    }
+
+    ChallengeArgs challenge;
+    OperationBuffer user_name;
+    bool has_user_name;
+};
 
 // Initialize method
 Handle<Value> Kerberos::AuthGSSClientWrap(const Arguments &args) {
@@ -416,94 +1224,114 @@ Handle<Value> Kerberos::AuthGSSClientWrap(const Arguments &args) {
 
   // Ensure valid call
   if(args.Length() != 3 && args.Length() != 4) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap, optional user name and callback function");
-  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !args[1]->IsString() && !args[2]->IsFunction()) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap, optional user name and callback function");
-  if(args.Length() == 4 && !KerberosContext::HasInstance(args[0]) && !args[1]->IsString() && !args[2]->IsString() && !args[2]->IsFunction()) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap, optional user name and callback function");
-
-  // Challenge string
-  char *challenge_str = NULL;
-  char *user_name_str = NULL;
+  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !IsChallenge(args[1]) && !args[2]->IsFunction()) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap, optional user name and callback function");
+  if(args.Length() == 4 && !KerberosContext::HasInstance(args[0]) && !IsChallenge(args[1]) && !args[2]->IsString() && !args[2]->IsFunction()) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap, optional user name and callback function");
 
   // Let's unpack the kerberos context
-  Local<Object> object = args[0]->ToObject();
-  KerberosContext *kerberos_context = KerberosContext::Unwrap<KerberosContext>(object);
+  ClientWrapOperation *operation = ClientWrapOperation::Acquire();
+  operation->context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
 
-  // Unpack the challenge string
-  Local<String> challenge = args[1]->ToString();
-  // Convert uri string to c-string
-  challenge_str = (char *)calloc(challenge->Utf8Length() + 1, sizeof(char));
-  if(challenge_str == NULL) die("Memory allocation failed");
-  // Write v8 string to c-string
-  challenge->WriteUtf8(challenge_str);
+  // Decode or copy the challenge straight into the operation
+  operation->challenge.Set(args[1]);
 
   // If we have a user string
   if(args.Length() == 4) {
-    // Unpack user name
-    Local<String> user_name = args[2]->ToString();
-    // Convert uri string to c-string
-    user_name_str = (char *)calloc(user_name->Utf8Length() + 1, sizeof(char));
-    if(user_name_str == NULL) die("Memory allocation failed");
-    // Write v8 string to c-string
-    user_name->WriteUtf8(user_name_str);
-  }
-
-  // Allocate a structure
-  AuthGSSClientWrapCall *call = (AuthGSSClientWrapCall *)calloc(1, sizeof(AuthGSSClientWrapCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->context = kerberos_context;
-  call->challenge = challenge_str;
-  call->user_name = user_name_str;
+    operation->user_name.CopyString(args[2]->ToString());
+    operation->has_user_name = true;
+  }
 
   // Unpack the callback
   Local<Function> callback = args.Length() == 4 ? Local<Function>::Cast(args[3]) : Local<Function>::Cast(args[2]);
 
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSClientWrap;
-  worker->mapper = _map_authGSSClientWrap;
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, callback));
+}
 
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+// Batch method
+Handle<Value> Kerberos::AuthGSSClientWrapMany(const Arguments &args) {
+  HandleScope scope;
 
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
-}
+  // Ensure valid call
+  if(!IsBatch(args, true)) return VException("Requires an array of { context, challenge, user } objects and a callback function");
 
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-// authGSSClientClean
-// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSClientClean(Worker *worker) {
-  gss_response *response;
+  // User names are optional but have to be strings
+  Local<Array> users = Local<Array>::Cast(args[0]);
+  for(uint32_t i = 0; i < users->Length(); i++) {
+    Local<Value> user = users->Get(i)->ToObject()->Get(String::NewSymbol("user"));
+    if(!user->IsUndefined() && !user->IsString()) return VException("Requires an array of { context, challenge, user } objects and a callback function");
+  }
 
-  // Unpack the parameter data struct
-  AuthGSSClientCleanCall *call = (AuthGSSClientCleanCall *)worker->parameters;
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  Operation *operations = NULL;
 
-  // Perform authentication step
-  response = authenticate_gss_client_clean(call->context->client_state);
+  // Unpack the items into operations, last first to keep the order
+  for(uint32_t i = items->Length(); i-- > 0;) {
+    Local<Object> item = items->Get(i)->ToObject();
+    ClientWrapOperation *operation = ClientWrapOperation::Acquire();
+    operation->context = KerberosContext::Unwrap<KerberosContext>(item->Get(String::NewSymbol("context"))->ToObject());
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-  } else {
-    worker->return_code = response->return_code;
+    Local<Value> challenge = item->Get(String::NewSymbol("challenge"));
+    if(!challenge->IsUndefined()) operation->challenge.Set(challenge);
+
+    // If we have a user string
+    Local<Value> user = item->Get(String::NewSymbol("user"));
+    if(!user->IsUndefined()) {
+      operation->user_name.CopyString(user->ToString());
+      operation->has_user_name = true;
+    }
+
+    operation->next = operations;
+    operations = operation;
   }
 
-  // Free up structure
-  free(call);
-  free(response);
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation ids, they can be passed to cancel
+  return scope.Close(kerberos->QueueBatch(operations, items->Length(), Local<Function>::Cast(args[1])));
 }
 
-static Handle<Value> _map_authGSSClientClean(Worker *worker) {
+// Sync method
+Handle<Value> Kerberos::AuthGSSClientWrapSync(const Arguments &args) {
   HandleScope scope;
-  // Return the return code
-  return scope.Close(Int32::New(worker->return_code));
+
+  // Ensure valid call
+  if(args.Length() != 2 && args.Length() != 3) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap and optional user name");
+  if(!KerberosContext::HasInstance(args[0]) || !IsChallenge(args[1])) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap and optional user name");
+  if(args.Length() == 3 && !args[2]->IsString()) return VException("Requires a GSS context, the result from the authGSSClientResponse after authGSSClientUnwrap and optional user name");
+
+  // The context can't be used while an async call is running on it
+  KerberosContext *context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
+  if(context->IsBusy()) return VException("GSS context has pending operations");
+
+  // Let's unpack the kerberos context
+  ClientWrapOperation *operation = ClientWrapOperation::Acquire();
+  operation->context = context;
+
+  // Decode or copy the challenge straight into the operation
+  operation->challenge.Set(args[1]);
+
+  // If we have a user string
+  if(args.Length() == 3) {
+    operation->user_name.CopyString(args[2]->ToString());
+    operation->has_user_name = true;
+  }
+
+  return scope.Close(RunSync(operation));
 }
 
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// authGSSClientClean
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class ClientCleanOperation : public PooledOperation<ClientCleanOperation> {
+  public:
+    static const OperationType kType = OPERATION_CLIENT_CLEAN;
+
+    void Execute() {
+      // Perform authentication step
+      SetResult(this, authenticate_gss_client_clean(context->client_state));
+    }
+};
+
 // Initialize method
 Handle<Value> Kerberos::AuthGSSClientClean(const Arguments &args) {
   HandleScope scope;
@@ -513,158 +1341,111 @@ Handle<Value> Kerberos::AuthGSSClientClean(const Arguments &args) {
   if(!KerberosContext::HasInstance(args[0]) && !args[1]->IsFunction()) return VException("Requires a GSS context and callback function");
 
   // Let's unpack the kerberos context
-  Local<Object> object = args[0]->ToObject();
-  KerberosContext *kerberos_context = KerberosContext::Unwrap<KerberosContext>(object);
-
-  // Allocate a structure
-  AuthGSSClientCleanCall *call = (AuthGSSClientCleanCall *)calloc(1, sizeof(AuthGSSClientCleanCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->context = kerberos_context;
-
-  // Unpack the callback
-  Local<Function> callback = Local<Function>::Cast(args[1]);
-
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSClientClean;
-  worker->mapper = _map_authGSSClientClean;
-
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+  ClientCleanOperation *operation = ClientCleanOperation::Acquire();
+  operation->context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
 
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[1])));
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // authGSSServerInit
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSServerInit(Worker *worker) {
-  gss_server_state *state;
-  gss_response *response;
+class ServerInitOperation : public PooledOperation<ServerInitOperation> {
+  public:
+    static const OperationType kType = OPERATION_SERVER_INIT;
 
-  // Allocate state
-  state = (gss_server_state *)malloc(sizeof(gss_server_state));
-  if(state == NULL) die("Memory allocation failed");
+    ServerInitOperation() : mech(AUTH_GSS_MECH_DEFAULT), state(NULL), context_id(0) {}
 
-  // Unpack the parameter data struct
-  AuthGSSServerCall *call = (AuthGSSServerCall *)worker->parameters;
-  // Start the kerberos... server
-  response = authenticate_gss_server_init(call->uri, state);
+    void Execute() {
+      // Allocate state
+      state = (gss_server_state *)malloc(sizeof(gss_server_state));
+      if(state == NULL) die("Memory allocation failed");
 
-  // Release the parameter struct memory
-  free(call->uri);
-  free(call);
+      // Start the kerberos... server
+      SetResult(this, authenticate_gss_server_init((const char *)uri.data, mech, state));
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-    free(state);
-  } else {
-    worker->return_value = state;
-  }
+      if(error) {
+        free(state);
+        state = NULL;
+      }
+    }
 
-  // Free structure
-  free(response);
-}
+    Handle<Value> Map() {
+      HandleScope scope;
 
-static Handle<Value> _map_authGSSServerInit(Worker *worker) {
-  HandleScope scope;
+      KerberosContext *context = KerberosContext::New();
+      context->server_state = state;
+      context->id = context_id;
+      return scope.Close(context->handle_);
+    }
 
-  KerberosContext *context = KerberosContext::New();
-  context->server_state = (gss_server_state *)worker->return_value;
-  // Persistent<Value> _context = Persistent<Value>::New(context->handle_);
-  return scope.Close(context->handle_);
-}
+    void Reset() {
+      state = NULL;
+      mech = AUTH_GSS_MECH_DEFAULT;
+    }
+
+    OperationBuffer uri;
+    // AUTH_GSS_MECH_* the acceptor is restricted to
+    int mech;
+    gss_server_state *state;
+    uint32_t context_id;
+};
 
 // Initialize method
 Handle<Value> Kerberos::AuthGSSServerInit(const Arguments &args) {
   HandleScope scope;
 
   // Ensure valid call
-  if(args.Length() != 2) return VException("Requires a service string uri and a callback function");
+  if(args.Length() != 2 && args.Length() != 3) return VException("Requires a service string uri, optional options object and a callback function");
   if(args.Length() == 2 && !args[0]->IsString() && !args[1]->IsFunction())
-      return VException("Requires a service string uri and a callback function");
-
-  Local<String> service = args[0]->ToString();
-  // Convert uri string to c-string
-  char *service_str = (char *)calloc(service->Utf8Length() + 1, sizeof(char));
-  if(service_str == NULL) die("Memory allocation failed");
+      return VException("Requires a service string uri, optional options object and a callback function");
+  if(args.Length() == 3 && (!args[0]->IsString() || !args[1]->IsObject() || !args[2]->IsFunction()))
+      return VException("Requires a service string uri, optional options object and a callback function");
 
-  // Write v8 string to c-string
-  service->WriteUtf8(service_str);
+  // Restrict the acceptor to one mechanism
+  int mech = AUTH_GSS_MECH_DEFAULT;
+  if(args.Length() == 3) {
+    const char *message = ParseMech(args[1]->ToObject(), &mech);
+    if(message != NULL) return VException(message);
+  }
 
-  // Allocate a structure
-  AuthGSSServerCall *call = (AuthGSSServerCall *)calloc(1, sizeof(AuthGSSServerCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->uri = service_str;
+  // Unpack the arguments into a recycled operation
+  ServerInitOperation *operation = ServerInitOperation::Acquire();
+  operation->uri.CopyString(args[0]->ToString());
+  operation->mech = mech;
+  operation->context_id = KerberosContext::NextId();
 
-  // Unpack the callback
-  Local<Function> callback = Local<Function>::Cast(args[1]);
-
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSServerInit;
-  worker->mapper = _map_authGSSServerInit;
-
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[args.Length() - 1])));
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // authGSSServerStep
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSServerStep(Worker *worker) {
-  gss_server_state *state;
-  gss_response *response;
-  char *challenge;
-
-  // Unpack the parameter data struct
-  AuthGSSServerStepCall *call = (AuthGSSServerStepCall *)worker->parameters;
-  // Get the state
-  state = call->context->server_state;
-  challenge = call->challenge;
-
-  // Check what kind of challenge we have
-  if(call->challenge == NULL) {
-    challenge = (char *)"";
-  }
-
-  // Perform authentication step
-  response = authenticate_gss_server_step(state, challenge);
-
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
-  } else {
-    worker->return_code = response->return_code;
-  }
+class ServerStepOperation : public PooledOperation<ServerStepOperation> {
+  public:
+    static const OperationType kType = OPERATION_SERVER_STEP;
+
+    void Execute() {
+      gss_server_state *state = context->server_state;
+      // Perform authentication step
+      state->response_format = challenge.response_format;
+      SetResult(this, authenticate_gss_server_step(state, challenge.token.data, challenge.token.length));
+
+      // Count the token bytes
+      token_in = challenge.token.length;
+      token_out = ResponseLength(state->response, &state->response_token);
+    }
 
-  // Free up structure
-  if(call->challenge != NULL) free(call->challenge);
-  free(call);
-  free(response);
-}
+    void Reset() {
+      challenge.Reset();
+    }
 
-static Handle<Value> _map_authGSSServerStep(Worker *worker) {
-  HandleScope scope;
-  // Return the return code
-  return scope.Close(Int32::New(worker->return_code));
-}
+    ChallengeArgs challenge;
+};
 
 // Initialize method
 Handle<Value> Kerberos::AuthGSSServerStep(const Arguments &args) {
@@ -673,82 +1454,97 @@ Handle<Value> Kerberos::AuthGSSServerStep(const Arguments &args) {
   // Ensure valid call
   if(args.Length() != 2 && args.Length() != 3) return VException("Requires a GSS context, optional challenge string and callback function");
   if(args.Length() == 2 && !KerberosContext::HasInstance(args[0])) return VException("Requires a GSS context, optional challenge string and callback function");
-  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !args[1]->IsString()) return VException("Requires a GSS context, optional challenge string and callback function");
+  if(args.Length() == 3 && !KerberosContext::HasInstance(args[0]) && !IsChallenge(args[1])) return VException("Requires a GSS context, optional challenge string and callback function");
 
-  // Challenge string
-  char *challenge_str = NULL;
   // Let's unpack the parameters
-  Local<Object> object = args[0]->ToObject();
-  KerberosContext *kerberos_context = KerberosContext::Unwrap<KerberosContext>(object);
+  ServerStepOperation *operation = ServerStepOperation::Acquire();
+  operation->context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
 
-  // If we have a challenge string
+  // If we have a challenge decode or copy it straight into the operation
   if(args.Length() == 3) {
-    // Unpack the challenge string
-    Local<String> challenge = args[1]->ToString();
-    // Convert uri string to c-string
-    challenge_str = (char *)calloc(challenge->Utf8Length() + 1, sizeof(char));
-    if(challenge_str == NULL) die("Memory allocation failed");
-    // Write v8 string to c-string
-    challenge->WriteUtf8(challenge_str);
+    operation->challenge.Set(args[1]);
   }
 
-  // Allocate a structure
-  AuthGSSServerStepCall *call = (AuthGSSServerStepCall *)calloc(1, sizeof(AuthGSSServerStepCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->context = kerberos_context;
-  call->challenge = challenge_str;
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[2])));
+}
+
+// Batch method
+Handle<Value> Kerberos::AuthGSSServerStepMany(const Arguments &args) {
+  HandleScope scope;
 
-  // Unpack the callback
-  Local<Function> callback = Local<Function>::Cast(args[2]);
+  // Ensure valid call
+  if(!IsBatch(args, false)) return VException("Requires an array of { context, challenge } objects and a callback function");
 
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSServerStep;
-  worker->mapper = _map_authGSSServerStep;
+  Local<Array> items = Local<Array>::Cast(args[0]);
+  Operation *operations = NULL;
 
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
+  // Unpack the items into operations, last first to keep the order
+  for(uint32_t i = items->Length(); i-- > 0;) {
+    Local<Object> item = items->Get(i)->ToObject();
+    ServerStepOperation *operation = ServerStepOperation::Acquire();
+    operation->context = KerberosContext::Unwrap<KerberosContext>(item->Get(String::NewSymbol("context"))->ToObject());
 
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
+    Local<Value> challenge = item->Get(String::NewSymbol("challenge"));
+    if(!challenge->IsUndefined()) operation->challenge.Set(challenge);
+
+    operation->next = operations;
+    operations = operation;
+  }
+
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation ids, they can be passed to cancel
+  return scope.Close(kerberos->QueueBatch(operations, items->Length(), Local<Function>::Cast(args[1])));
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-// authGSSServerClean
+// Acceptor credential cache
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-static void _authGSSServerClean(Worker *worker) {
-  gss_response *response;
-
-  // Unpack the parameter data struct
-  AuthGSSServerCleanCall *call = (AuthGSSServerCleanCall *)worker->parameters;
+// Drop the cached credentials of a service, or of all services, so the next
+// server init reads the keytab again. Server contexts using them keep them.
+Handle<Value> Kerberos::InvalidateAcceptorCredentials(const Arguments &args) {
+  HandleScope scope;
 
-  // Perform authentication step
-  response = authenticate_gss_server_clean(call->context->server_state);
+  // Ensure valid call
+  if(args.Length() > 1 || (args.Length() == 1 && !args[0]->IsString() && !args[0]->IsUndefined()))
+    return VException("Requires an optional service string");
 
-  // If we have an error mark worker as having had an error
-  if(response->return_code == AUTH_GSS_ERROR) {
-    worker->error = TRUE;
-    worker->error_code = response->return_code;
-    worker->error_message = response->message;
+  if(args.Length() == 1 && args[0]->IsString()) {
+    String::Utf8Value service(args[0]);
+    authenticate_gss_server_invalidate(*service);
   } else {
-    worker->return_code = response->return_code;
+    authenticate_gss_server_invalidate(NULL);
   }
 
-  // Free up structure
-  free(call);
-  free(response);
+  return scope.Close(Undefined());
 }
 
-static Handle<Value> _map_authGSSServerClean(Worker *worker) {
+// How many seconds cached credentials are used before they are acquired
+// again, applies to credentials acquired from now on
+Handle<Value> Kerberos::SetAcceptorCredentialTtl(const Arguments &args) {
   HandleScope scope;
-  // Return the return code
-  return scope.Close(Int32::New(worker->return_code));
+
+  // Ensure valid call
+  if(args.Length() != 1 || !args[0]->IsUint32()) return VException("Requires a ttl in seconds");
+
+  authenticate_gss_server_set_cred_ttl(args[0]->Uint32Value());
+  return scope.Close(Undefined());
 }
 
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// authGSSServerClean
+// +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class ServerCleanOperation : public PooledOperation<ServerCleanOperation> {
+  public:
+    static const OperationType kType = OPERATION_SERVER_CLEAN;
+
+    void Execute() {
+      // Perform authentication step
+      SetResult(this, authenticate_gss_server_clean(context->server_state));
+    }
+};
+
 // Initialize method
 Handle<Value> Kerberos::AuthGSSServerClean(const Arguments &args) {
   HandleScope scope;
@@ -758,85 +1554,119 @@ Handle<Value> Kerberos::AuthGSSServerClean(const Arguments &args) {
   if(!KerberosContext::HasInstance(args[0]) && !args[1]->IsFunction()) return VException("Requires a GSS context and callback function");
 
   // Let's unpack the kerberos context
-  Local<Object> object = args[0]->ToObject();
-  KerberosContext *kerberos_context = KerberosContext::Unwrap<KerberosContext>(object);
-
-  // Allocate a structure
-  AuthGSSServerCleanCall *call = (AuthGSSServerCleanCall *)calloc(1, sizeof(AuthGSSServerCleanCall));
-  if(call == NULL) die("Memory allocation failed");
-  call->context = kerberos_context;
+  ServerCleanOperation *operation = ServerCleanOperation::Acquire();
+  operation->context = KerberosContext::Unwrap<KerberosContext>(args[0]->ToObject());
 
-  // Unpack the callback
-  Local<Function> callback = Local<Function>::Cast(args[1]);
-
-  // Let's allocate some space
-  Worker *worker = new Worker();
-  worker->error = false;
-  worker->request.data = worker;
-  worker->callback = Persistent<Function>::New(callback);
-  worker->parameters = call;
-  worker->execute = _authGSSServerClean;
-  worker->mapper = _map_authGSSServerClean;
-
-  // Schedule the worker with lib_uv
-  uv_queue_work(uv_default_loop(), &worker->request, Kerberos::Process, (uv_after_work_cb)Kerberos::After);
-
-  // Return no value as it's callback based
-  return scope.Close(Undefined());
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(args.This());
+  // Return the operation id, it can be passed to cancel
+  return scope.Close(kerberos->Queue(operation, Local<Function>::Cast(args[1])));
 }
 
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // UV Lib callbacks
 // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 void Kerberos::Process(uv_work_t* work_req) {
-  // Grab the worker
-  Worker *worker = static_cast<Worker*>(work_req->data);
-  // Execute the worker code
-  worker->execute(worker);
+  // Grab the operation
+  Operation *operation = static_cast<Operation*>(work_req->data);
+  // Execute the operation code
+  operation->Run();
 }
 
 void Kerberos::After(uv_work_t* work_req) {
   // Grab the scope of the call from Node
   v8::HandleScope scope;
 
-  // Get the worker reference
-  Worker *worker = static_cast<Worker*>(work_req->data);
+  // Get the operation reference
+  Operation *operation = static_cast<Operation*>(work_req->data);
+  v8::Handle<v8::Value> err = v8::Null();
+  v8::Handle<v8::Value> result = v8::Null();
+
+  // Feed the estimate the adaptive dispatch works from
+  operation->Estimate()->Add(operation->execute_time);
+  uint64_t callback_start = uv_hrtime();
+  KERBEROS_PROBE5(complete, operation->Type(), operation->id, operation->context, operation->error_code, operation->execute_time);
 
   // If we have an error
-  if(worker->error) {
-    v8::Local<v8::Value> err = v8::Exception::Error(v8::String::New(worker->error_message));
+  if(operation->error) {
+    Stats::RecordError(operation);
+    err = v8::Exception::Error(v8::String::New(operation->error_message));
     Local<Object> obj = err->ToObject();
-    obj->Set(NODE_PSYMBOL("code"), Int32::New(worker->error_code));
-    v8::Local<v8::Value> args[2] = { err, v8::Local<v8::Value>::New(v8::Null()) };
-    // Execute the error
-    v8::TryCatch try_catch;
-    // Call the callback
-    worker->callback->Call(v8::Context::GetCurrent()->Global(), ARRAY_SIZE(args), args);
-    // If we have an exception handle it as a fatalexception
-    if (try_catch.HasCaught()) {
-      node::FatalException(try_catch);
-    }
+    obj->Set(NODE_PSYMBOL("code"), Int32::New(operation->error_code));
   } else {
     // // Map the data
-    v8::Handle<v8::Value> result = worker->mapper(worker);
-    // Set up the callback with a null first
-    v8::Handle<v8::Value> args[2] = { v8::Local<v8::Value>::New(v8::Null()), result};
-    // Wrap the callback function call in a TryCatch so that we can call
-    // node's FatalException afterwards. This makes it possible to catch
-    // the exception from JavaScript land using the
-    // process.on('uncaughtException') event.
-    v8::TryCatch try_catch;
-    // Call the callback
-    worker->callback->Call(v8::Context::GetCurrent()->Global(), ARRAY_SIZE(args), args);
-    // If we have an exception handle it as a fatalexception
-    if (try_catch.HasCaught()) {
-      node::FatalException(try_catch);
+    result = operation->Map();
+  }
+
+  if(operation->batch == NULL) {
+    Callback(operation->callback, err, result);
+  } else {
+    // Park the result, the batch calls back once all are in
+    OperationBatch *batch = operation->batch;
+    batch->results->Set(operation->batch_index, operation->error ? err : result);
+
+    if(--batch->remaining == 0) {
+      Callback(batch->callback, v8::Null(), batch->results);
+      delete batch;
+    }
+  }
+
+  Stats::RecordPhase(operation->Type(), PHASE_CALLBACK, uv_hrtime() - callback_start);
+
+  // Free the in flight slot for the longest waiting operation
+  Kerberos *owner = operation->owner;
+  if(operation->dispatched) {
+    owner->in_flight--;
+
+    Operation *waiting = owner->waiting_head;
+    if(waiting != NULL) {
+      owner->waiting_head = waiting->next;
+      if(owner->waiting_head == NULL) owner->waiting_tail = NULL;
+      owner->queued--;
+      Dispatch(waiting);
     }
   }
 
-  // Clean up the memory
-  worker->callback.Dispose();
-  delete worker;
+  // Only now let the next operation on the context touch its state, the
+  // callback above may still have been reading the response
+  if(operation->context != NULL) {
+    Operation *next = operation->context->Complete();
+    if(next != NULL) {
+      next->owner->queued--;
+      Dispatch(next);
+    }
+  }
+
+  // No longer cancellable
+  if(operation->pending_prev != NULL) {
+    operation->pending_prev->pending_next = operation->pending_next;
+  } else {
+    owner->pending_head = operation->pending_next;
+  }
+  if(operation->pending_next != NULL) operation->pending_next->pending_prev = operation->pending_prev;
+
+  // Hand the operation back to its pool
+  if(!operation->callback.IsEmpty()) {
+    operation->callback.Dispose();
+    operation->callback.Clear();
+  }
+  operation->Release();
+  owner->Unref();
+}
+
+void Kerberos::Callback(Handle<Function> callback, Handle<Value> err, Handle<Value> result) {
+  // Set up the callback with the error first
+  v8::Handle<v8::Value> args[2] = { err, result };
+  // Wrap the callback function call in a TryCatch so that we can call
+  // node's FatalException afterwards. This makes it possible to catch
+  // the exception from JavaScript land using the
+  // process.on('uncaughtException') event.
+  v8::TryCatch try_catch;
+  // Call the callback
+  callback->Call(v8::Context::GetCurrent()->Global(), ARRAY_SIZE(args), args);
+  // If we have an exception handle it as a fatalexception
+  if (try_catch.HasCaught()) {
+    node::FatalException(try_catch);
+  }
 }
 
 // Exporting function
@@ -844,6 +1674,9 @@ extern "C" void init(Handle<Object> target) {
   HandleScope scope;
   Kerberos::Initialize(target);
   KerberosContext::Initialize(target);
+  KerberosCredential::Initialize(target);
+  Stats::Initialize(target);
+  Trace::Initialize(target);
 }
 
 NODE_MODULE(kerberos, init);
@@ -10,6 +10,8 @@
 #include <v8.h>
 
 #include "util.h"
+#include "operation.h"
+#include "thread_pool.h"
 
 extern "C" {
   #include "kerberosgss.h"
@@ -18,11 +20,13 @@ extern "C" {
 using namespace v8;
 using namespace node;
 
+class KerberosCredential;
+
 class Kerberos : public ObjectWrap {
 
 public:
-  Kerberos();
-  ~Kerberos() {};
+  Kerberos(ThreadPool *pool, bool owns_pool);
+  ~Kerberos();
 
   // Constructor used for creating new Kerberos objects from C++
   static Persistent<FunctionTemplate> constructor_template;
@@ -36,18 +40,102 @@ public:
   static Handle<Value> AuthGSSClientUnwrap(const Arguments &args);
   static Handle<Value> AuthGSSClientWrap(const Arguments &args);
   static Handle<Value> AuthGSSClientClean(const Arguments &args);
+  static Handle<Value> AcquireCredential(const Arguments &args);
+  // Fetch service tickets ahead of the first contexts
+  static Handle<Value> Prefetch(const Arguments &args);
 
   static Handle<Value> AuthGSSServerInit(const Arguments &args);
   static Handle<Value> AuthGSSServerStep(const Arguments &args);
   static Handle<Value> AuthGSSServerClean(const Arguments &args);
 
+  // Module function for the service name cache
+  static Handle<Value> ClearServiceNames(const Arguments &args);
+  // Module functions for the acceptor credential cache
+  static Handle<Value> InvalidateAcceptorCredentials(const Arguments &args);
+  static Handle<Value> SetAcceptorCredentialTtl(const Arguments &args);
+
+  // Sync methods, run on the calling thread
+  static Handle<Value> AuthGSSClientUnwrapSync(const Arguments &args);
+  static Handle<Value> AuthGSSClientWrapSync(const Arguments &args);
+
+  // Cancel an operation that has not started yet
+  static Handle<Value> Cancel(const Arguments &args);
+  // Operations waiting to be dispatched
+  static Handle<Value> QueueDepth(const Arguments &args);
+  // Operations dispatched and not yet called back
+  static Handle<Value> InFlight(const Arguments &args);
+
+  // Batch methods, one callback for many contexts
+  static Handle<Value> AuthGSSClientStepMany(const Arguments &args);
+  static Handle<Value> AuthGSSClientUnwrapMany(const Arguments &args);
+  static Handle<Value> AuthGSSClientWrapMany(const Arguments &args);
+  static Handle<Value> AuthGSSServerStepMany(const Arguments &args);
+
+  // Refresh the credentials on our pool, calls back with the new expiry
+  Handle<Value> QueueRefresh(KerberosCredential *credential, Handle<Function> callback);
+
 private:
   static Handle<Value> New(const Arguments &args);
 
+  // Parse the pool options given to the constructor
+  static const char *ParseOptions(Handle<Object> object, ThreadPoolOptions *options, bool *dedicated);
+
+  // Schedules an operation on our thread pool, returns its id
+  Handle<Value> Queue(Operation *operation, Handle<Function> callback);
+  // Schedules a list of operations linked through next with one callback,
+  // returns their ids
+  Handle<Value> QueueBatch(Operation *operations, uint32_t count, Handle<Function> callback);
+  // Takes a hold for the operation, true if it can run right away. Fails
+  // and delivers it when it would have to wait behind a full queue.
+  bool Schedule(Operation *operation);
+  static void Dispatch(Operation *operation);
+  // Counts the operation as in flight, or parks it until a slot frees up
+  bool TakeSlot(Operation *operation);
+  // Takes an operation out of the wait list, false if it is not there
+  bool RemoveWaiting(Operation *operation);
+  // Runs an operation on the calling thread, returns the result or throws
+  static Handle<Value> RunSync(Operation *operation);
   // Handles the uv calls
   static void Process(uv_work_t* work_req);
   // Called after work is done
   static void After(uv_work_t* work_req);
+  // Calls back with the result of an operation
+  static void Callback(Handle<Function> callback, Handle<Value> err, Handle<Value> result);
+
+  // Pool shared by all instances created without pool options
+  static ThreadPool *default_pool;
+
+  // Pool the operations of this instance run on
+  ThreadPool *pool;
+  // Did we create the pool for this instance only
+  bool owns_pool;
+  // Operations queued and not yet called back, linked through pending_next
+  Operation *pending_head;
+  // Last id handed out
+  static uint32_t last_id;
+
+  // Operations waiting for an in flight slot, linked through next
+  Operation *waiting_head;
+  Operation *waiting_tail;
+  // Operations waiting in a context queue or the wait list
+  uint32_t queued;
+  // Operations submitted to the pool
+  uint32_t in_flight;
+  // Caps, 0 for no in flight cap and -1 for no queue cap
+  uint32_t max_in_flight;
+  int64_t max_queued;
+
+  // Fetch tickets through a traced krb5 context on client init
+  bool trace;
+  // Fetches at least this slow in ns go to the outlier ring buffer
+  uint64_t trace_threshold;
+
+  // Run operations inline when their type usually finishes quickly
+  bool adaptive;
+  // Estimated execute time in nanoseconds below which we run inline
+  uint64_t inline_threshold;
+  // Run the operations that need no KDC inline
+  bool inline_cached;
 };
 
 #endif
@@ -1,12 +1,248 @@
 var kerberos = require('../build/Release/kerberos')
-  , KerberosNative = kerberos.Kerberos;
+  , KerberosNative = kerberos.Kerberos
+  , EventEmitter = require('events').EventEmitter
+  , inherits = require('util').inherits
+  , os = require('os')
+  , path = require('path');
 
-var Kerberos = function() {
-  this._native_kerberos = new KerberosNative(); 
+// options (all optional, any of them gives the instance its own pool
+// instead of the shared one)
+//  threads     number of worker threads for the GSS calls, default 4
+//  threadName  worker thread name prefix, default 'kerberos'
+//  cpus        array of cpus to pin the workers to (linux only)
+//  adaptive         run wrap and unwrap calls inline when they usually
+//                   finish quickly, callbacks still fire asynchronously
+//  inlineThreshold  inline cutoff in microseconds for adaptive, default 50
+//  inlineCached     run client steps that need no KDC inline (later legs
+//                   and first legs with the service ticket in the ccache),
+//                   callbacks still fire asynchronously, default false.
+//                   Each first leg looks its ticket up on the event loop
+//                   thread: nearly free for a keytab login's MEMORY ccache,
+//                   a locked file read for FILE ccaches and a round trip to
+//                   the daemon for KCM ones
+//  maxInFlight  most operations handed to the pool at once, default no cap
+//  maxQueued    most operations waiting for the pool or for their context,
+//               calls over it fail with AUTH_GSS_OVERLOADED, default no cap
+//  trace           fetch the service ticket through a traced krb5 context
+//                  on client init, the record shows up as context.trace.
+//                  Needs MIT krb5 1.11 or later, throws otherwise
+//  traceThreshold  fetches taking this many ms or more are kept for
+//                  Kerberos.traces(), default 500
+//  renewAt  fraction of their lifetime after which credentials from
+//           acquireCredential are renewed in the background, default 0.75
+//  expiryWarning  ms before an established context runs out that
+//                 'contextExpiring' fires, default 60000
+//  Promise  constructor kerberos.promises builds its promises with, default
+//           the global Promise (older node versions have none)
+//
+// Renewal events
+//  'renewed' (credential)             new tickets are in use
+//  'renewalFailed' (err, credential)  retried sooner as expiry gets closer
+//  'expired' (credential)             renewal gave up, the tickets ran out
+//
+// Context events, for contexts stepped through this instance until cleaned
+//  'contextExpiring' (context)  expiryWarning ms left, re-authenticate now
+//                               (see context.expiresAt, lifetime and flags)
+var Kerberos = function(options) {
+  EventEmitter.call(this);
+  options = options || {};
+  this._native_kerberos = new KerberosNative(options); 
+  this._renewAt = options.renewAt == null ? 0.75 : options.renewAt;
+  this._expiryWarning = options.expiryWarning == null ? 60000 : options.expiryWarning;
+  this.promises = new KerberosPromises(this, options.Promise || global.Promise);
 }
 
-Kerberos.prototype.authGSSClientInit = function(uri, flags, callback) {
-  return this._native_kerberos.authGSSClientInit(uri, flags, callback);
+inherits(Kerberos, EventEmitter);
+
+// options (optional)
+//  credential  KerberosCredential from acquireCredential to initiate with
+//              instead of looking up the default ccache on every step,
+//              defaults to the one from login
+//  mech        'krb5' for raw krb5 tokens, 'spnego' for SPNEGO wrapped
+//              ones, default whatever the GSS library picks. Raw krb5
+//              saves the SPNEGO framing and any extra negotiation legs.
+Kerberos.prototype.authGSSClientInit = function(uri, flags, options, callback) {
+  if(typeof options == 'function') {
+    callback = options;
+    options = null;
+  }
+
+  if(this.credential != null && (options == null || options.credential == null)) {
+    options = { credential: this.credential, mech: options == null ? null : options.mech };
+  }
+
+  if(options == null) return this._native_kerberos.authGSSClientInit(uri, flags, callback);
+  return this._native_kerberos.authGSSClientInit(uri, flags, options, callback);
+}
+
+// Acquire initiator credentials once for many client contexts. options
+// (optional) is { principal, password, keytab }:
+//  without a principal the default one of the ccache is used
+//  with a password the credentials come from the KDC instead of the ccache
+//  with a keytab (path or type:residual) the principal logs in from it
+//  into a MEMORY ccache private to the credential, nothing touches disk
+//  with a snapshot path a keytab login starts from the unexpired tickets
+//  saved there by credential.saveSnapshot, see login
+//  with a ccache name a keytab login shares its tickets, see login
+// Calls back with a KerberosCredential.
+var valueOrNull = function(value) {
+  return value == null ? null : value;
+}
+
+// Per user, created 0700 by the first login to use it
+var defaultLockDir = function() {
+  return path.join(os.tmpdir(), 'kerberos-' + process.getuid());
+}
+
+Kerberos.prototype.acquireCredential = function(options, callback) {
+  var self = this;
+
+  if(typeof options == 'function') {
+    callback = options;
+    options = {};
+  }
+
+  options = options || {};
+  return this._native_kerberos.acquireCredential(valueOrNull(options.principal)
+    , valueOrNull(options.password), valueOrNull(options.keytab), valueOrNull(options.snapshot)
+    , valueOrNull(options.ccache), options.ccache == null ? null : (options.lockDir || defaultLockDir()), function(err, credential) {
+    if(err) return callback(err);
+    self._scheduleRenewal(credential);
+    callback(null, credential);
+  });
+}
+
+// Fetch the service tickets of services (e.g. 'mongodb@host1') in
+// parallel on the pool, so the first contexts to them only do local crypto.
+// options (optional) is { credential }, defaulting to the one from login.
+// Calls back with [{ service, duration, error }] in order, duration in ms
+// and error null for the tickets that were fetched.
+Kerberos.prototype.prefetch = function(services, options, callback) {
+  if(typeof options == 'function') {
+    callback = options;
+    options = null;
+  }
+
+  if(services.length == 0) {
+    return process.nextTick(function() { callback(null, []); });
+  }
+
+  var credential = options != null && options.credential != null ? options.credential : this.credential;
+  return this._native_kerberos.prefetch(services, valueOrNull(credential), callback);
+}
+
+// Renewal keeps the credential alive until stopped
+Kerberos.prototype.stopRenewal = function(credential) {
+  credential.stopRenewal();
+}
+
+// Arm the native timer of a credential for renewAt of its ticket lifetime
+Kerberos.prototype._scheduleRenewal = function(credential) {
+  var expiresAt = credential.expiresAt;
+  if(expiresAt == null || this._renewAt <= 0) return;
+
+  var obtainedAt = credential.obtainedAt;
+  var delay = obtainedAt + (expiresAt - obtainedAt) * this._renewAt - Date.now();
+  this._renewIn(credential, Math.max(0, delay));
+}
+
+Kerberos.prototype._renewIn = function(credential, delay) {
+  var self = this;
+
+  // Re-arm before telling the listeners, so they can stop the renewal
+  credential.renewIn(this._native_kerberos, delay, function(err) {
+    if(!err) {
+      self._scheduleRenewal(credential);
+      return self.emit('renewed', credential);
+    }
+
+    // Retry a quarter of what is left, between a second and a minute
+    var left = credential.expiresAt - Date.now();
+    if(left > 0) self._renewIn(credential, Math.max(1000, Math.min(60000, left / 4)));
+
+    self.emit('renewalFailed', err, credential);
+    if(left <= 0) self.emit('expired', credential);
+  });
+}
+
+// Log in from a client keytab, { principal, keytab, snapshot }, and
+// initiate all client contexts of this instance with the result.
+//
+// snapshot (default $KERBEROS_TICKET_SNAPSHOT) is a file the tickets are
+// saved to, owner only, when the process exits. The next login of the same
+// principal restores the ones that did not expire, a TGT still good skips
+// the KDC and so do the service tickets of the contexts it had. A snapshot
+// not owned by the current user, or writable by anyone else, is ignored.
+// A shared ccache outlives the process anyway and takes no snapshot.
+//
+// ccache (e.g. 'KCM:' or 'KEYRING:persistent:<uid>') puts the tickets in a
+// ccache shared by every process logged in to it, say the workers of a
+// cluster, instead of a private one. Reads go straight to the ccache, the
+// first process to need a ticket gets it from the KDC under an flock in
+// lockDir while the others wait for it, for up to 10 seconds. lockDir must
+// be writable by the current user only, it is created 0700 when missing,
+// default kerberos-<uid> in os.tmpdir(). Avoid FILE: ccaches, every store
+// rewrites the whole file.
+Kerberos.prototype.login = function(options, callback) {
+  var self = this;
+  var snapshot = options.snapshot !== undefined || options.ccache != null ? options.snapshot : process.env.KERBEROS_TICKET_SNAPSHOT;
+
+  return this.acquireCredential({ principal: options.principal, keytab: options.keytab, snapshot: snapshot
+    , ccache: options.ccache, lockDir: options.lockDir }, function(err, credential) {
+    if(err) return callback(err);
+    self.credential = credential;
+    if(snapshot) self._snapshotOnExit(snapshot);
+    callback(null, credential);
+  });
+}
+
+// Save the tickets of the current login at exit, once per instance
+Kerberos.prototype._snapshotOnExit = function(path) {
+  var self = this;
+  var armed = this._snapshotPath != null;
+
+  this._snapshotPath = path;
+  if(armed) return;
+
+  process.on('exit', function() {
+    if(self.credential == null) return;
+    // Nothing to do about it this late, the next login goes to the KDC
+    try { self.credential.saveSnapshot(self._snapshotPath); } catch(err) {}
+  });
+}
+
+// Longest delay setTimeout takes
+var MAX_TIMEOUT = 0x7fffffff;
+
+// Emit 'contextExpiring' expiryWarning ms before an established context runs
+// out. The timer doesn't keep the process alive.
+Kerberos.prototype._watchExpiry = function(context) {
+  var self = this;
+  var expiresAt = context.expiresAt;
+  if(expiresAt == null || context._expiryTimer != null) return;
+
+  var delay = Math.max(0, expiresAt - this._expiryWarning - Date.now());
+  if(delay > MAX_TIMEOUT) return;
+
+  context._expiryTimer = setTimeout(function() {
+    context._expiryTimer = null;
+    self.emit('contextExpiring', context);
+  }, delay);
+  context._expiryTimer.unref();
+}
+
+Kerberos.prototype._unwatchExpiry = function(context) {
+  if(context._expiryTimer == null) return;
+  clearTimeout(context._expiryTimer);
+  context._expiryTimer = null;
+}
+
+// Step callback that starts watching the context once it is established
+var stepped = function(self, context, callback) {
+  return function(err, result) {
+    if(!err) self._watchExpiry(context);
+    callback(err, result);
+  }
 }
 
 Kerberos.prototype.authGSSClientStep = function(context, challenge, callback) {
@@ -15,7 +251,7 @@ Kerberos.prototype.authGSSClientStep = function(context, challenge, callback) {
     challenge = '';
   }
 
-  return this._native_kerberos.authGSSClientStep(context, challenge, callback);
+  return this._native_kerberos.authGSSClientStep(context, challenge, stepped(this, context, callback));
 }
 
 Kerberos.prototype.authGSSClientUnwrap = function(context, challenge, callback) {
@@ -37,9 +273,135 @@ Kerberos.prototype.authGSSClientWrap = function(context, challenge, user_name, c
 }
 
 Kerberos.prototype.authGSSClientClean = function(context, callback) {
+  this._unwatchExpiry(context);
   return this._native_kerberos.authGSSClientClean(context, callback);
 }
 
+// Sync variants for the cheap per message calls, return the result code and
+// throw on error. The context must not have async calls pending.
+Kerberos.prototype.authGSSClientUnwrapSync = function(context, challenge) {
+  return this._native_kerberos.authGSSClientUnwrapSync(context, challenge == null ? '' : challenge);
+}
+
+Kerberos.prototype.authGSSClientWrapSync = function(context, challenge, user_name) {
+  if(user_name == null) return this._native_kerberos.authGSSClientWrapSync(context, challenge);
+  return this._native_kerberos.authGSSClientWrapSync(context, challenge, user_name);
+}
+
+// Raw token variants, take the challenge as a Buffer and leave the raw
+// response token in context.responseBuffer instead of context.response
+var EMPTY_TOKEN = new Buffer(0);
+
+Kerberos.prototype.authGSSClientStepBuffer = function(context, token, callback) {
+  if(typeof token == 'function') {
+    callback = token;
+    token = EMPTY_TOKEN;
+  }
+
+  return this._native_kerberos.authGSSClientStep(context, token, stepped(this, context, callback));
+}
+
+Kerberos.prototype.authGSSClientUnwrapBuffer = function(context, token, callback) {
+  if(typeof token == 'function') {
+    callback = token;
+    token = EMPTY_TOKEN;
+  }
+
+  return this._native_kerberos.authGSSClientUnwrap(context, token, callback);
+}
+
+Kerberos.prototype.authGSSClientWrapBuffer = function(context, token, user_name, callback) {
+  if(typeof user_name == 'function') {
+    callback = user_name;
+    user_name = '';
+  }
+
+  return this._native_kerberos.authGSSClientWrap(context, token, user_name, callback);
+}
+
+// options (optional)
+//  mech  'krb5' to only accept raw krb5 tokens, 'spnego' to only accept
+//        SPNEGO restricted to negotiating krb5, default any mechanism the
+//        keytab allows. Works without a service too.
+Kerberos.prototype.authGSSServerInit = function(uri, options, callback) {
+  if(typeof options == 'function') {
+    callback = options;
+    options = null;
+  }
+
+  if(options == null) return this._native_kerberos.authGSSServerInit(uri, callback);
+  return this._native_kerberos.authGSSServerInit(uri, options, callback);
+}
+
+Kerberos.prototype.authGSSServerClean = function(context, callback) {
+  this._unwatchExpiry(context);
+  return this._native_kerberos.authGSSServerClean(context, callback);
+}
+
+// challenge is the client token base64 encoded, the response comes back the
+// same way in context.response
+Kerberos.prototype.authGSSServerStep = function(context, challenge, callback) {
+  return this._native_kerberos.authGSSServerStep(context, challenge, stepped(this, context, callback));
+}
+
+Kerberos.prototype.authGSSServerStepBuffer = function(context, token, callback) {
+  return this._native_kerberos.authGSSServerStep(context, token, stepped(this, context, callback));
+}
+
+// Batch variants, take an array of { context, challenge } objects (wrapMany
+// also takes an optional user) and call back once with an array holding the
+// return code or Error of each item, in order. Each context should appear
+// only once, its response is read after the whole batch has completed.
+var batch = function(method, steps) {
+  return function(items, callback) {
+    var self = this;
+
+    if(items.length == 0) {
+      return process.nextTick(function() { callback(null, []); });
+    }
+
+    if(!steps) return this._native_kerberos[method](items, callback);
+    return this._native_kerberos[method](items, function(err, results) {
+      if(!err) {
+        for(var i = 0; i < items.length; i++) {
+          if(!(results[i] instanceof Error)) self._watchExpiry(items[i].context);
+        }
+      }
+
+      callback(err, results);
+    });
+  }
+}
+
+Kerberos.prototype.stepMany = batch('authGSSClientStepMany', true);
+Kerberos.prototype.unwrapMany = batch('authGSSClientUnwrapMany');
+Kerberos.prototype.wrapMany = batch('authGSSClientWrapMany');
+Kerberos.prototype.serverStepMany = batch('authGSSServerStepMany', true);
+
+// Cancel operations by the id (or array of ids for the batch calls) the
+// async methods return. Operations that have not started yet call back with
+// an error with code AUTH_GSS_CANCELLED, returns true if any was cancelled.
+Kerberos.prototype.cancel = function(id) {
+  if(!Array.isArray(id)) return this._native_kerberos.cancel(id);
+
+  var cancelled = false;
+  for(var i = 0; i < id.length; i++) {
+    if(this._native_kerberos.cancel(id[i])) cancelled = true;
+  }
+
+  return cancelled;
+}
+
+// Operations waiting for an in flight slot or for their context
+Kerberos.prototype.queueDepth = function() {
+  return this._native_kerberos.queueDepth();
+}
+
+// Operations handed to the pool and not called back yet
+Kerberos.prototype.inFlight = function() {
+  return this._native_kerberos.inFlight();
+}
+
 Kerberos.prototype.acquireAlternateCredentials = function(user_name, password, domain) {
   return this._native_kerberos.acquireAlternateCredentials(user_name, password, domain); 
 }
@@ -61,9 +423,141 @@ Kerberos.prototype.queryContextAttribute = function(attribute) {
   return this._native_kerberos.queryContextAttribute(attribute);
 }
 
+// Promise versions of the async methods, reached through kerberos.promises.
+// Each takes the arguments of its callback version minus the callback, plus
+// an optional trailing { signal }. The signal needs an aborted flag and
+// either addEventListener or on, like AbortSignal or an EventEmitter.
+// Aborting rejects with an AbortError and takes the operation off the
+// queue if it has not started.
+//
+// Methods on a context resolve with { result, response, responseBuffer },
+// the batch ones with an array of those or Errors, read when the operation
+// called back. By the time a then handler runs the next operation queued on
+// the context may already be replacing the response.
+var KerberosPromises = function(kerberos, Promise) {
+  this._kerberos = kerberos;
+  this._Promise = Promise;
+}
+
+var isOptions = function(value) {
+  return value != null && typeof value == 'object' && !Array.isArray(value)
+    && !Buffer.isBuffer(value) && 'signal' in value;
+}
+
+var abortError = function() {
+  var err = new Error('The operation was aborted');
+  err.name = 'AbortError';
+  err.code = Kerberos.AUTH_GSS_CANCELLED;
+  return err;
+}
+
+var listen = function(signal, listener) {
+  if(typeof signal.addEventListener == 'function') return signal.addEventListener('abort', listener);
+  signal.on('abort', listener);
+}
+
+var unlisten = function(signal, listener) {
+  if(typeof signal.removeEventListener == 'function') return signal.removeEventListener('abort', listener);
+  signal.removeListener('abort', listener);
+}
+
+var captured = function(context, result) {
+  return { result: result, response: context.response, responseBuffer: context.responseBuffer };
+}
+
+// capture is 'context' for methods on the context in their first argument,
+// 'items' for the batch ones
+var promised = function(method, capture) {
+  return function() {
+    var kerberos = this._kerberos;
+    var Promise = this._Promise;
+    var args = Array.prototype.slice.call(arguments);
+    var signal = isOptions(args[args.length - 1]) ? args.pop().signal : null;
+    var target = args[0];
+
+    if(typeof Promise != 'function') throw new Error('No Promise implementation, pass one as options.Promise');
+
+    return new Promise(function(resolve, reject) {
+      if(signal && signal.aborted) return reject(abortError());
+
+      var onAbort = function() {
+        unlisten(signal, onAbort);
+        if(id != null) kerberos.cancel(id);
+        reject(abortError());
+      }
+
+      args.push(function(err, result) {
+        if(signal) unlisten(signal, onAbort);
+        if(err) return reject(err);
+        if(capture == 'context') return resolve(captured(target, result));
+        if(capture == 'items') {
+          return resolve(result.map(function(item, i) {
+            return item instanceof Error ? item : captured(target[i].context, item);
+          }));
+        }
+
+        resolve(result);
+      });
+
+      var id = kerberos[method].apply(kerberos, args);
+      if(signal) listen(signal, onAbort);
+    });
+  }
+}
+
+var promisedMethods = {
+  authGSSClientInit: null, acquireCredential: null, login: null, prefetch: null
+  , authGSSClientClean: null, authGSSServerInit: null, authGSSServerClean: null
+  , authGSSClientStep: 'context', authGSSClientUnwrap: 'context', authGSSClientWrap: 'context'
+  , authGSSClientStepBuffer: 'context', authGSSClientUnwrapBuffer: 'context'
+  , authGSSClientWrapBuffer: 'context', authGSSServerStep: 'context', authGSSServerStepBuffer: 'context'
+  , stepMany: 'items', unwrapMany: 'items', wrapMany: 'items', serverStepMany: 'items'
+};
+
+Object.keys(promisedMethods).forEach(function(method) {
+  KerberosPromises.prototype[method] = promised(method, promisedMethods[method]);
+});
+
+// Snapshot of the process wide counters: per operation type histograms of
+// queue wait, execute and callback time in nanoseconds, errors by GSS
+// routine error, live contexts, token bytes, the operations run inline and
+// the first legs that waited for a concurrent fetch of the same service
+// ticket
+Kerberos.stats = function() {
+  return kerberos.stats();
+}
+
+// Traced ticket fetches over their instance's traceThreshold, oldest first,
+// at most the last 64
+Kerberos.traces = function() {
+  return kerberos.traces();
+}
+
+// Client init interns the imported and canonicalized name of each service,
+// this forgets them so hosts are looked up again
+Kerberos.clearServiceNames = function() {
+  return kerberos.clearServiceNames();
+}
+
+// Server contexts share the acceptor credentials of their service, they are
+// acquired again after the ttl (300 seconds by default) or once invalidated,
+// e.g. after the keytab was rotated. Without a service all are dropped.
+Kerberos.invalidateAcceptorCredentials = function(service) {
+  return service == null ? kerberos.invalidateAcceptorCredentials() : kerberos.invalidateAcceptorCredentials(service);
+}
+
+Kerberos.setAcceptorCredentialTtl = function(seconds) {
+  return kerberos.setAcceptorCredentialTtl(seconds);
+}
+
 // Some useful result codes
 Kerberos.AUTH_GSS_CONTINUE     = 0;
 Kerberos.AUTH_GSS_COMPLETE     = 1;
+
+// Error codes
+Kerberos.AUTH_GSS_ERROR        = -1;
+Kerberos.AUTH_GSS_CANCELLED    = -2;
+Kerberos.AUTH_GSS_OVERLOADED   = -3;
      
 // Some useful gss flags 
 Kerberos.GSS_C_DELEG_FLAG      = 1;
@@ -1,13 +1,25 @@
 #include "kerberos_context.h"
+#include <node_buffer.h>
+#include "operation.h"
+#include "stats.h"
 
 Persistent<FunctionTemplate> KerberosContext::constructor_template;
+uint32_t KerberosContext::last_id = 0;
 
 KerberosContext::KerberosContext() : ObjectWrap() {
   client_state = NULL;
   server_state = NULL;
+  queue_head = NULL;
+  queue_tail = NULL;
+  busy = false;
+  id = 0;
+  trace = NULL;
+  Stats::ContextCreated();
 }
 
 KerberosContext::~KerberosContext() {
+  free(trace);
+  Stats::ContextDestroyed();
 }
 
 KerberosContext* KerberosContext::New() {
@@ -29,7 +41,75 @@ Handle<Value> KerberosContext::New(const Arguments &args) {
   return args.This();
 }
 
+bool KerberosContext::Schedule(Operation *operation) {
+  // Pending operations hold the context
+  Ref();
+
+  if(!busy) {
+    busy = true;
+    return true;
+  }
+
+  // Wait behind the others
+  operation->next = NULL;
+  if(queue_tail == NULL) {
+    queue_head = operation;
+  } else {
+    queue_tail->next = operation;
+  }
+  queue_tail = operation;
+  return false;
+}
+
+Operation *KerberosContext::Complete() {
+  Operation *operation = queue_head;
+
+  if(operation != NULL) {
+    queue_head = operation->next;
+    if(queue_head == NULL) queue_tail = NULL;
+    operation->next = NULL;
+  } else {
+    busy = false;
+  }
+
+  // Release the hold of the finished operation
+  Unref();
+  return operation;
+}
+
+bool KerberosContext::Remove(Operation *operation) {
+  Operation *previous = NULL;
+
+  for(Operation *current = queue_head; current != NULL; current = current->next) {
+    if(current != operation) {
+      previous = current;
+      continue;
+    }
+
+    // Unlink it
+    if(previous == NULL) {
+      queue_head = current->next;
+    } else {
+      previous->next = current->next;
+    }
+    if(queue_tail == current) queue_tail = previous;
+    current->next = NULL;
+
+    // Release the hold of the removed operation
+    Unref();
+    return true;
+  }
+
+  return false;
+}
+
 static Persistent<String> response_symbol;
+static Persistent<String> response_buffer_symbol;
+static Persistent<String> id_symbol;
+static Persistent<String> trace_symbol;
+static Persistent<String> lifetime_symbol;
+static Persistent<String> expires_at_symbol;
+static Persistent<String> flags_symbol;
 
 void KerberosContext::Initialize(Handle<Object> target) {
   // Grab the scope of the call from Node
@@ -42,9 +122,22 @@ void KerberosContext::Initialize(Handle<Object> target) {
 
   // Property symbols
   response_symbol = NODE_PSYMBOL("response");
+  response_buffer_symbol = NODE_PSYMBOL("responseBuffer");
+  id_symbol = NODE_PSYMBOL("id");
+  trace_symbol = NODE_PSYMBOL("trace");
+  lifetime_symbol = NODE_PSYMBOL("lifetime");
+  expires_at_symbol = NODE_PSYMBOL("expiresAt");
+  flags_symbol = NODE_PSYMBOL("flags");
 
   // Getter for the response
   constructor_template->InstanceTemplate()->SetAccessor(response_symbol, ResponseGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(response_buffer_symbol, ResponseBufferGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(id_symbol, IdGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(trace_symbol, TraceGetter);
+  // Established context lifetime and negotiated flags
+  constructor_template->InstanceTemplate()->SetAccessor(lifetime_symbol, LifetimeGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(expires_at_symbol, ExpiresAtGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(flags_symbol, FlagsGetter);
 
   // Set up the Symbol for the Class on the Module
   target->Set(String::NewSymbol("KerberosContext"), constructor_template->GetFunction());
@@ -72,3 +165,101 @@ Handle<Value> KerberosContext::ResponseGetter(Local<String> property, const Acce
     return scope.Close(String::New(client_state->response));
   }
 }
+
+// Raw response of the last operation that was given a Buffer challenge
+Handle<Value> KerberosContext::ResponseBufferGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+
+  gss_buffer_desc *token = NULL;
+
+  KerberosContext *context = ObjectWrap::Unwrap<KerberosContext>(info.Holder());
+
+  if(context->client_state != NULL && context->client_state->response_token.value != NULL) {
+    token = &context->client_state->response_token;
+  } else if(context->server_state != NULL && context->server_state->response_token.value != NULL) {
+    token = &context->server_state->response_token;
+  }
+
+  if(token == NULL) {
+    return scope.Close(Null());
+  }
+
+  Buffer *buffer = Buffer::New((const char *)token->value, token->length);
+  return scope.Close(buffer->handle_);
+}
+
+Handle<Value> KerberosContext::IdGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosContext *context = ObjectWrap::Unwrap<KerberosContext>(info.Holder());
+  return scope.Close(Uint32::New(context->id));
+}
+
+// KDC trace of the init call
+Handle<Value> KerberosContext::TraceGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosContext *context = ObjectWrap::Unwrap<KerberosContext>(info.Holder());
+
+  if(context->trace == NULL) {
+    return scope.Close(Null());
+  }
+
+  return scope.Close(Trace::ToObject(context->trace));
+}
+
+bool KerberosContext::Established(OM_uint32 *flags, time_t *expires) {
+  if(client_state != NULL && client_state->established) {
+    *flags = client_state->ret_flags;
+    *expires = client_state->expires;
+    return true;
+  } else if(server_state != NULL && server_state->established) {
+    *flags = server_state->ret_flags;
+    *expires = server_state->expires;
+    return true;
+  }
+
+  return false;
+}
+
+// Seconds the established context has left, null before that or for never
+Handle<Value> KerberosContext::LifetimeGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosContext *context = ObjectWrap::Unwrap<KerberosContext>(info.Holder());
+  OM_uint32 flags;
+  time_t expires;
+
+  if(!context->Established(&flags, &expires) || expires == 0) {
+    return scope.Close(Null());
+  }
+
+  time_t now = time(NULL);
+  return scope.Close(Number::New(expires > now ? (double)(expires - now) : 0));
+}
+
+// When the established context runs out, ms since the epoch, null before
+// that or for never
+Handle<Value> KerberosContext::ExpiresAtGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosContext *context = ObjectWrap::Unwrap<KerberosContext>(info.Holder());
+  OM_uint32 flags;
+  time_t expires;
+
+  if(!context->Established(&flags, &expires) || expires == 0) {
+    return scope.Close(Null());
+  }
+
+  return scope.Close(Number::New(expires * 1000.0));
+}
+
+// GSS_C_*_FLAG bits negotiated for the established context, null before that
+Handle<Value> KerberosContext::FlagsGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosContext *context = ObjectWrap::Unwrap<KerberosContext>(info.Holder());
+  OM_uint32 flags;
+  time_t expires;
+
+  if(!context->Established(&flags, &expires)) {
+    return scope.Close(Null());
+  }
+
+  return scope.Close(Uint32::New(flags));
+}
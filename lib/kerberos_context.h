@@ -13,6 +13,10 @@ extern "C" {
   #include "kerberosgss.h"
 }
 
+#include "trace.h"
+
+class Operation;
+
 using namespace v8;
 using namespace node;
 
@@ -37,12 +41,54 @@ public:
   // Public constructor
   static KerberosContext* New();
 
+  // Operations on one context run one at a time in submission order, so
+  // calls pipelined from js never share the gss context or the response.
+  // Schedule returns true if the operation can be dispatched right away,
+  // Complete returns the next one to dispatch once the current one is done.
+  // Both keep the context alive while operations are pending.
+  bool Schedule(Operation *operation);
+  Operation *Complete();
+
+  // Take an operation that has not been dispatched yet out of the queue,
+  // dropping its hold on the context. False if it is not queued here.
+  bool Remove(Operation *operation);
+
+  // Is an operation pending, the sync calls must not run then
+  inline bool IsBusy() {
+    return busy;
+  };
+
+  // Hand out a context id, ids are reserved when the init call is queued
+  static inline uint32_t NextId() {
+    return ++last_id;
+  };
+
   gss_client_state *client_state;
   gss_server_state *server_state;
+  // Id tying trace records to the context
+  uint32_t id;
+  // KDC trace of the init call, NULL unless tracing was on
+  TraceRecord *trace;
 
 private:
+  // Pending operations, linked through Operation::next
+  Operation *queue_head;
+  Operation *queue_tail;
+  // Is an operation running on the thread pool
+  bool busy;
+  // Last id handed out
+  static uint32_t last_id;
+
   static Handle<Value> New(const Arguments &args);
 
   static Handle<Value> ResponseGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> ResponseBufferGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> IdGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> TraceGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> LifetimeGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> ExpiresAtGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> FlagsGetter(Local<String> property, const AccessorInfo& info);
+  // Whether the state is established, with its flags and deadline
+  bool Established(OM_uint32 *flags, time_t *expires);
 };
 #endif
@@ -0,0 +1,208 @@
+#include "kerberos_credential.h"
+#include "kerberos.h"
+
+void die(const char *message);
+
+Persistent<FunctionTemplate> KerberosCredential::constructor_template;
+
+KerberosCredential::KerberosCredential() : ObjectWrap() {
+  cred = NULL;
+  timer = NULL;
+  armed = false;
+}
+
+KerberosCredential::~KerberosCredential() {
+  // Never armed here, an armed timer holds the object
+  if(timer != NULL) uv_close((uv_handle_t *)timer, TimerClosed);
+  if(cred != NULL) authenticate_gss_cred_release(cred);
+}
+
+KerberosCredential* KerberosCredential::New() {
+  HandleScope scope;
+
+  Local<Object> obj = constructor_template->GetFunction()->NewInstance();
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(obj);
+
+  return credential;
+}
+
+Handle<Value> KerberosCredential::New(const Arguments &args) {
+  HandleScope scope;
+  // Create code object
+  KerberosCredential *credential = new KerberosCredential();
+  // Wrap it
+  credential->Wrap(args.This());
+  // Return the object
+  return args.This();
+}
+
+static Persistent<String> principal_symbol;
+static Persistent<String> obtained_at_symbol;
+static Persistent<String> expires_at_symbol;
+
+void KerberosCredential::Initialize(Handle<Object> target) {
+  // Grab the scope of the call from Node
+  HandleScope scope;
+  // Define a new function template
+  Local<FunctionTemplate> t = FunctionTemplate::New(New);
+  constructor_template = Persistent<FunctionTemplate>::New(t);
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+  constructor_template->SetClassName(String::NewSymbol("KerberosCredential"));
+
+  // Property symbols
+  principal_symbol = NODE_PSYMBOL("principal");
+  obtained_at_symbol = NODE_PSYMBOL("obtainedAt");
+  expires_at_symbol = NODE_PSYMBOL("expiresAt");
+
+  // Getters for the principal and the ticket times
+  constructor_template->InstanceTemplate()->SetAccessor(principal_symbol, PrincipalGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(obtained_at_symbol, ObtainedAtGetter);
+  constructor_template->InstanceTemplate()->SetAccessor(expires_at_symbol, ExpiresAtGetter);
+
+  // Renewal timer
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "renewIn", RenewIn);
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "stopRenewal", StopRenewal);
+  // Ticket snapshot
+  NODE_SET_PROTOTYPE_METHOD(constructor_template, "saveSnapshot", SaveSnapshot);
+
+  // Set up the Symbol for the Class on the Module
+  target->Set(String::NewSymbol("KerberosCredential"), constructor_template->GetFunction());
+}
+
+// Principal the credentials are for
+Handle<Value> KerberosCredential::PrincipalGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(info.Holder());
+
+  if(credential->cred == NULL) {
+    return scope.Close(Null());
+  }
+
+  return scope.Close(String::New(credential->cred->principal));
+}
+
+// When the current tickets were obtained, ms since the epoch
+Handle<Value> KerberosCredential::ObtainedAtGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(info.Holder());
+  time_t obtained;
+  time_t expires;
+
+  if(credential->cred == NULL) {
+    return scope.Close(Null());
+  }
+
+  authenticate_gss_cred_times(credential->cred, &obtained, &expires);
+  return scope.Close(Number::New(obtained * 1000.0));
+}
+
+// When the current tickets run out, ms since the epoch, null for never
+Handle<Value> KerberosCredential::ExpiresAtGetter(Local<String> property, const AccessorInfo& info) {
+  HandleScope scope;
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(info.Holder());
+  time_t obtained;
+  time_t expires;
+
+  if(credential->cred == NULL) {
+    return scope.Close(Null());
+  }
+
+  authenticate_gss_cred_times(credential->cred, &obtained, &expires);
+  if(expires == 0) {
+    return scope.Close(Null());
+  }
+
+  return scope.Close(Number::New(expires * 1000.0));
+}
+
+// renewIn(kerberos, ms, callback), replaces any armed renewal
+Handle<Value> KerberosCredential::RenewIn(const Arguments &args) {
+  HandleScope scope;
+
+  // Ensure valid call
+  if(args.Length() != 3 || !args[0]->IsObject() || !Kerberos::constructor_template->HasInstance(args[0])
+    || !args[1]->IsNumber() || args[1]->NumberValue() < 0 || !args[2]->IsFunction())
+      return ThrowException(Exception::Error(String::New("Requires a Kerberos object, a delay in ms and a callback function")));
+
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(args.This());
+
+  if(credential->timer == NULL) {
+    credential->timer = (uv_timer_t *)malloc(sizeof(uv_timer_t));
+    if(credential->timer == NULL) die("Memory allocation failed");
+    uv_timer_init(uv_default_loop(), credential->timer);
+    credential->timer->data = credential;
+    // Don't keep the process alive just to renew
+    uv_unref((uv_handle_t *)credential->timer);
+  }
+
+  credential->Stop();
+  credential->renew_owner = Persistent<Object>::New(args[0]->ToObject());
+  credential->renew_callback = Persistent<Function>::New(Local<Function>::Cast(args[2]));
+  credential->armed = true;
+  credential->Ref();
+
+  uv_timer_start(credential->timer, (uv_timer_cb)RenewTimer, (uint64_t)args[1]->NumberValue(), 0);
+  return scope.Close(Undefined());
+}
+
+Handle<Value> KerberosCredential::StopRenewal(const Arguments &args) {
+  HandleScope scope;
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(args.This());
+  credential->Stop();
+  return scope.Close(Undefined());
+}
+
+// saveSnapshot(path), throws when the tickets could not be written. The
+// file is written synchronously, a renewal in progress doesn't hold it up.
+Handle<Value> KerberosCredential::SaveSnapshot(const Arguments &args) {
+  HandleScope scope;
+
+  // Ensure valid call
+  if(args.Length() != 1 || !args[0]->IsString())
+    return ThrowException(Exception::Error(String::New("Requires a path string")));
+
+  KerberosCredential *credential = ObjectWrap::Unwrap<KerberosCredential>(args.This());
+  if(credential->cred == NULL)
+    return ThrowException(Exception::Error(String::New("Credential was never acquired")));
+
+  String::Utf8Value path(args[0]->ToString());
+  gss_response *response = authenticate_gss_cred_save(credential->cred, *path);
+
+  if(response->return_code == AUTH_GSS_ERROR) {
+    Local<Value> error = Exception::Error(String::New(response->message != NULL ? response->message : "Failed to save the ticket snapshot"));
+    free(response);
+    return ThrowException(error);
+  }
+
+  free(response);
+  return scope.Close(Undefined());
+}
+
+void KerberosCredential::Stop() {
+  if(!armed) return;
+
+  uv_timer_stop(timer);
+  renew_owner.Dispose();
+  renew_owner.Clear();
+  renew_callback.Dispose();
+  renew_callback.Clear();
+  armed = false;
+  Unref();
+}
+
+void KerberosCredential::RenewTimer(uv_timer_t *handle, int status) {
+  HandleScope scope;
+  KerberosCredential *credential = (KerberosCredential *)handle->data;
+
+  // The operation takes its own hold on the callback and the credentials,
+  // queue it before Stop lets go of ours
+  Local<Function> callback = Local<Function>::New(credential->renew_callback);
+  Kerberos *kerberos = ObjectWrap::Unwrap<Kerberos>(credential->renew_owner);
+  kerberos->QueueRefresh(credential, callback);
+
+  credential->Stop();
+}
+
+void KerberosCredential::TimerClosed(uv_handle_t *handle) {
+  free(handle);
+}
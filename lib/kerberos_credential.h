@@ -0,0 +1,80 @@
+#ifndef KERBEROS_CREDENTIAL_H
+#define KERBEROS_CREDENTIAL_H
+
+#include <node.h>
+#include <gssapi/gssapi.h>
+#include <gssapi/gssapi_generic.h>
+#include <gssapi/gssapi_krb5.h>
+
+#include <node_object_wrap.h>
+#include <v8.h>
+
+extern "C" {
+  #include "kerberosgss.h"
+}
+
+using namespace v8;
+using namespace node;
+
+class Kerberos;
+
+// Initiator credentials from Kerberos.acquireCredential, passed to any
+// number of authGSSClientInit calls. The contexts share the GSS credential
+// handle so the ccache is resolved once instead of on every step.
+//
+// renewIn arms a one shot timer that refreshes the credentials on the pool
+// of a Kerberos instance and calls back with the new expiry. An armed timer
+// keeps the object alive but not the loop.
+//
+// saveSnapshot writes the unexpired tickets of a keytab login to a file a
+// later login of the same principal starts from. It runs on the calling
+// thread so it can be used from an exit handler.
+class KerberosCredential : public ObjectWrap {
+
+public:
+  KerberosCredential();
+  ~KerberosCredential();
+
+  static inline bool HasInstance(Handle<Value> val) {
+    if (!val->IsObject()) return false;
+    Local<Object> obj = val->ToObject();
+    return constructor_template->HasInstance(obj);
+  };
+
+  // Constructor used for creating new credential objects from C++
+  static Persistent<FunctionTemplate> constructor_template;
+
+  // Initialize function for the object
+  static void Initialize(Handle<Object> target);
+
+  // Public constructor
+  static KerberosCredential* New();
+
+  // Our reference, client states take their own
+  gss_client_cred *cred;
+
+private:
+  static Handle<Value> New(const Arguments &args);
+
+  // Renewal timer methods
+  static Handle<Value> RenewIn(const Arguments &args);
+  static Handle<Value> StopRenewal(const Arguments &args);
+  // Ticket snapshot for the next process
+  static Handle<Value> SaveSnapshot(const Arguments &args);
+  static void RenewTimer(uv_timer_t *handle, int status);
+  static void TimerClosed(uv_handle_t *handle);
+  // Disarm, dropping the hold on the object
+  void Stop();
+
+  static Handle<Value> PrincipalGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> ObtainedAtGetter(Local<String> property, const AccessorInfo& info);
+  static Handle<Value> ExpiresAtGetter(Local<String> property, const AccessorInfo& info);
+
+  // Created on first use, closed with the object
+  uv_timer_t *timer;
+  // Instance to refresh on and who to tell, set while armed
+  Persistent<Object> renew_owner;
+  Persistent<Function> renew_callback;
+  bool armed;
+};
+#endif
@@ -17,12 +17,30 @@
 #include "kerberosgss.h"
 
 #include "base64.h"
+#include "probes.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <krb5.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// gss_acquire_cred_with_password and gss_set_neg_mechs are extensions, MIT
+// has them in gssapi_ext.h
+#if defined(__has_include)
+# if __has_include(<gssapi/gssapi_ext.h>)
+#  include <gssapi/gssapi_ext.h>
+#  define KERBEROS_HAVE_PASSWORD_CREDS 1
+#  define KERBEROS_HAVE_NEG_MECHS 1
+# endif
+#endif
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
@@ -37,24 +55,894 @@ void die1(const char *message) {
   exit(1);
 }
 
-gss_response *authenticate_gss_client_init(const char* service, long int gss_flags, gss_client_state* state) {
+// Drop the response of the previous operation, whatever its format
+static void clear_response(char **response, gss_buffer_t response_token) {
+  OM_uint32 min_stat;
+
+  if(*response != NULL) {
+    free(*response);
+    *response = NULL;
+  }
+
+  if(response_token->value != NULL)
+    gss_release_buffer(&min_stat, response_token);
+  response_token->value = NULL;
+  response_token->length = 0;
+}
+
+// 1.3.6.1.5.5.2, not every GSS library exports it
+static gss_OID_desc spnego_mech_desc = { 6, (void *)"\x2b\x06\x01\x05\x05\x02" };
+
+// OID of an AUTH_GSS_MECH_* value, GSS_C_NO_OID for the library default
+static gss_OID mech_oid(int mech) {
+  switch(mech) {
+    case AUTH_GSS_MECH_KRB5: return gss_mech_krb5;
+    case AUTH_GSS_MECH_SPNEGO: return &spnego_mech_desc;
+    default: return GSS_C_NO_OID;
+  }
+}
+
+// Deadline of a context good for time_rec more seconds, 0 for never
+static time_t context_expiry(OM_uint32 time_rec) {
+  if(time_rec == GSS_C_INDEFINITE) return 0;
+  return time(NULL) + time_rec;
+}
+
+// Keep an output token as the response, either base64 encoded or as the raw
+// gss buffer itself. Takes ownership of output_token.
+static void set_response(int format, gss_buffer_t output_token, char **response, gss_buffer_t response_token) {
+  OM_uint32 min_stat;
+
+  if(format == AUTH_GSS_RESPONSE_RAW) {
+    *response_token = *output_token;
+  } else {
+    *response = base64_encode((const unsigned char *)output_token->value, output_token->length);
+    gss_release_buffer(&min_stat, output_token);
+  }
+
+  output_token->value = NULL;
+  output_token->length = 0;
+}
+
+// Imported service names, interned so contexts to a service we have seen
+// duplicate its name instead of importing and canonicalizing it again
+#define SERVICE_NAME_CACHE_SIZE 64
+
+typedef struct service_name {
+  char *service;
+  gss_name_t name;
+  struct service_name *next;
+} service_name;
+
+static pthread_mutex_t service_name_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Most recently added first
+static service_name *service_names = NULL;
+static int service_name_count = 0;
+
+static void service_name_free(service_name *entry) {
+  OM_uint32 min_stat;
+
+  while(entry != NULL) {
+    service_name *next = entry->next;
+    gss_release_name(&min_stat, &entry->name);
+    free(entry->service);
+    free(entry);
+    entry = next;
+  }
+}
+
+// Fill name with a copy of the interned name of service
+static OM_uint32 import_service_name(OM_uint32 *min_stat, const char *service, gss_name_t *name) {
+  gss_buffer_desc name_token = GSS_C_EMPTY_BUFFER;
+  gss_name_t imported = GSS_C_NO_NAME;
+  gss_name_t canonical = GSS_C_NO_NAME;
+  service_name *entry;
+  service_name *evicted = NULL;
+  OM_uint32 maj_stat;
+  OM_uint32 ignored;
+
+  // Duplicating is a copy, fine to do under the lock
+  pthread_mutex_lock(&service_name_mutex);
+  for(entry = service_names; entry != NULL; entry = entry->next) {
+    if(strcmp(entry->service, service) == 0) break;
+  }
+  maj_stat = entry != NULL ? gss_duplicate_name(min_stat, entry->name, name) : GSS_S_FAILURE;
+  pthread_mutex_unlock(&service_name_mutex);
+
+  if(entry != NULL) return maj_stat;
+
+  // Import server name first
+  name_token.length = strlen(service);
+  name_token.value = (char *)service;
+
+  maj_stat = gss_import_name(min_stat, &name_token, gss_krb5_nt_service_name, &imported);
+  if(GSS_ERROR(maj_stat)) return maj_stat;
+
+  // Canonicalize once for the krb5 mech so any host lookups happen now,
+  // names that won't canonicalize are interned as imported
+  if(GSS_ERROR(gss_canonicalize_name(&ignored, imported, gss_mech_krb5, &canonical))) {
+    canonical = imported;
+    imported = GSS_C_NO_NAME;
+  } else {
+    gss_release_name(&ignored, &imported);
+  }
+
+  maj_stat = gss_duplicate_name(min_stat, canonical, name);
+  if(GSS_ERROR(maj_stat)) {
+    gss_release_name(&ignored, &canonical);
+    return maj_stat;
+  }
+
+  entry = calloc(1, sizeof(service_name));
+  if(entry == NULL) die1("Memory allocation failed");
+  entry->service = strdup(service);
+  if(entry->service == NULL) die1("Memory allocation failed");
+  entry->name = canonical;
+
+  pthread_mutex_lock(&service_name_mutex);
+  entry->next = service_names;
+  service_names = entry;
+  service_name_count++;
+
+  // Drop the oldest when full, racing misses may leave a duplicate entry
+  // behind that ages out the same way
+  if(service_name_count > SERVICE_NAME_CACHE_SIZE) {
+    service_name *last = service_names;
+    while(last->next->next != NULL) last = last->next;
+    evicted = last->next;
+    last->next = NULL;
+    service_name_count--;
+  }
+  pthread_mutex_unlock(&service_name_mutex);
+
+  service_name_free(evicted);
+  return maj_stat;
+}
+
+void authenticate_gss_client_clear_names(void) {
+  service_name *cleared;
+
+  pthread_mutex_lock(&service_name_mutex);
+  cleared = service_names;
+  service_names = NULL;
+  service_name_count = 0;
+  pthread_mutex_unlock(&service_name_mutex);
+
+  service_name_free(cleared);
+}
+
+// Error response with a message of our own
+static gss_response *message_error(const char *message) {
+  gss_response *response = calloc(1, sizeof(gss_response));
+  if(response == NULL) die1("Memory allocation failed");
+  response->message = (char *)message;
+  response->return_code = AUTH_GSS_ERROR;
+  return response;
+}
+
+// Error response for a failed krb5 call
+static gss_response *krb5_error(krb5_context context, krb5_error_code code) {
+  const char *text = krb5_get_error_message(context, code);
+  gss_response *response = calloc(1, sizeof(gss_response));
+  if(response == NULL) die1("Memory allocation failed");
+
+  response->message = strdup(text != NULL ? text : "Kerberos error");
+  if(response->message == NULL) die1("Memory allocation failed");
+  response->return_code = AUTH_GSS_ERROR;
+  // Count it like GSS does a mech failure
+  response->major_status = GSS_S_FAILURE;
+  response->minor_status = (OM_uint32)code;
+
+  if(text != NULL) krb5_free_error_message(context, text);
+  return response;
+}
+
+// Handles are referenced from the loop and the worker threads
+static void handle_release(gss_cred_handle *handle) {
+  OM_uint32 min_stat;
+
+  if(__sync_sub_and_fetch(&handle->refs, 1) > 0) return;
+
+  // Let go of the GSS handle before the ccache it refers to
+  gss_release_cred(&min_stat, &handle->cred);
+  if(handle->krb5 != NULL) {
+    // Other processes still use a shared ccache
+    if(handle->lock_prefix != NULL) {
+      krb5_cc_close(handle->krb5, handle->ccache);
+    } else {
+      krb5_cc_destroy(handle->krb5, handle->ccache);
+    }
+    krb5_free_context(handle->krb5);
+  }
+  free(handle->lock_prefix);
+  free(handle->ccache_name);
+  free(handle);
+}
+
+// Take a reference to the current handle of cred
+static gss_cred_handle *cred_borrow(gss_client_cred *cred) {
+  gss_cred_handle *handle;
+
+  pthread_mutex_lock(&cred->lock);
+  handle = cred->handle;
+  __sync_fetch_and_add(&handle->refs, 1);
+  pthread_mutex_unlock(&cred->lock);
+
+  return handle;
+}
+
+static gss_client_cred *cred_new(char *principal, char *keytab, int password, gss_cred_handle *handle) {
+  gss_client_cred *cred = calloc(1, sizeof(gss_client_cred));
+  if(cred == NULL) die1("Memory allocation failed");
+  if(pthread_mutex_init(&cred->lock, NULL) != 0) die1("Failed to create credential mutex");
+  if(pthread_mutex_init(&cred->refresh_lock, NULL) != 0) die1("Failed to create credential mutex");
+
+  cred->handle = handle;
+  cred->principal = principal;
+  cred->keytab = keytab;
+  cred->password = password;
+  cred->refs = 1;
+  return cred;
+}
+
+// Acquire through GSS, from the ccache or with a password. display gets the
+// principal name when not NULL.
+static gss_response *acquire_handle(const char* principal, const char* password, gss_cred_handle** handle, char** display) {
   OM_uint32 maj_stat;
   OM_uint32 min_stat;
+  OM_uint32 lifetime = 0;
   gss_buffer_desc name_token = GSS_C_EMPTY_BUFFER;
+  gss_name_t name = GSS_C_NO_NAME;
+  gss_name_t cred_name = GSS_C_NO_NAME;
+  gss_cred_id_t gss_cred = GSS_C_NO_CREDENTIAL;
+  gss_response *response = NULL;
+  time_t now = time(NULL);
+
+  *handle = NULL;
+
+  if(principal != NULL) {
+    name_token.length = strlen(principal);
+    name_token.value = (char *)principal;
+
+    maj_stat = gss_import_name(&min_stat, &name_token, GSS_C_NT_USER_NAME, &name);
+    if(GSS_ERROR(maj_stat)) {
+      response = gss_error(maj_stat, min_stat);
+      response->return_code = AUTH_GSS_ERROR;
+      goto end;
+    }
+  }
+
+  if(password != NULL) {
+#ifdef KERBEROS_HAVE_PASSWORD_CREDS
+    gss_buffer_desc password_token;
+    password_token.length = strlen(password);
+    password_token.value = (char *)password;
+
+    maj_stat = gss_acquire_cred_with_password(&min_stat, name, &password_token, GSS_C_INDEFINITE,
+                                              GSS_C_NO_OID_SET, GSS_C_INITIATE, &gss_cred, NULL, NULL);
+#else
+    response = message_error("Password credentials are not supported by this GSS library");
+    goto end;
+#endif
+  } else {
+    maj_stat = gss_acquire_cred(&min_stat, name, GSS_C_INDEFINITE,
+                                GSS_C_NO_OID_SET, GSS_C_INITIATE, &gss_cred, NULL, NULL);
+  }
+
+  if(GSS_ERROR(maj_stat)) {
+    response = gss_error(maj_stat, min_stat);
+    response->return_code = AUTH_GSS_ERROR;
+    goto end;
+  }
+
+  // Asking for the name resolves the ccache now rather than on the first step
+  maj_stat = gss_inquire_cred(&min_stat, gss_cred, &cred_name, &lifetime, NULL, NULL);
+  if(!GSS_ERROR(maj_stat) && display != NULL) {
+    maj_stat = gss_display_name(&min_stat, cred_name, &name_token, NULL);
+  }
+
+  if(GSS_ERROR(maj_stat)) {
+    response = gss_error(maj_stat, min_stat);
+    response->return_code = AUTH_GSS_ERROR;
+    goto end;
+  }
+
+  if(display != NULL) {
+    *display = (char *)malloc(name_token.length + 1);
+    if(*display == NULL) die1("Memory allocation failed");
+    memcpy(*display, name_token.value, name_token.length);
+    (*display)[name_token.length] = 0;
+    gss_release_buffer(&min_stat, &name_token);
+  }
+
+  *handle = calloc(1, sizeof(gss_cred_handle));
+  if(*handle == NULL) die1("Memory allocation failed");
+  (*handle)->cred = gss_cred;
+  (*handle)->refs = 1;
+  // GSS only tells us what is left
+  (*handle)->obtained = now;
+  (*handle)->expires = lifetime == GSS_C_INDEFINITE ? 0 : now + lifetime;
+  gss_cred = GSS_C_NO_CREDENTIAL;
+
+end:
+  if(gss_cred != GSS_C_NO_CREDENTIAL)
+    gss_release_cred(&min_stat, &gss_cred);
+  if(cred_name != GSS_C_NO_NAME)
+    gss_release_name(&min_stat, &cred_name);
+  if(name != GSS_C_NO_NAME)
+    gss_release_name(&min_stat, &name);
+
+  return response;
+}
+
+// Tickets with less than this many seconds left are not snapshotted or
+// restored
+#define SNAPSHOT_MIN_LIFETIME 60
+
+// Copy the tickets of client in source ending after cutoff into dest, if
+// any. The TGT goes to tgt instead, returns 1 if there was a usable one.
+static int copy_tickets(krb5_context context, krb5_ccache source, krb5_principal client, time_t cutoff, krb5_ccache dest, krb5_creds* tgt) {
+  char tgt_name[1024];
+  krb5_principal owner = NULL;
+  krb5_cc_cursor cursor;
+  krb5_creds entry;
+  char *client_name = NULL;
+  char *realm;
+  int found = 0;
+
+  // Only our own tickets
+  if(krb5_cc_get_principal(context, source, &owner) != 0
+    || !krb5_principal_compare(context, owner, client)
+    || krb5_unparse_name(context, client, &client_name) != 0) goto end;
+
+  realm = strrchr(client_name, '@');
+  if(realm == NULL) goto end;
+  snprintf(tgt_name, sizeof(tgt_name), "krbtgt/%s@%s", realm + 1, realm + 1);
+
+  if(krb5_cc_start_seq_get(context, source, &cursor) != 0) goto end;
+  while(krb5_cc_next_cred(context, source, &cursor, &entry) == 0) {
+    char *server_name = NULL;
+
+    if(entry.times.endtime > cutoff && !krb5_is_config_principal(context, entry.server)
+      && krb5_unparse_name(context, entry.server, &server_name) == 0) {
+      if(!found && strcmp(server_name, tgt_name) == 0) {
+        // Handed over with its contents
+        *tgt = entry;
+        found = 1;
+        krb5_free_unparsed_name(context, server_name);
+        continue;
+      }
+
+      if(dest != NULL) krb5_cc_store_cred(context, dest, &entry);
+      krb5_free_unparsed_name(context, server_name);
+    }
+
+    krb5_free_cred_contents(context, &entry);
+  }
+  krb5_cc_end_seq_get(context, source, &cursor);
+
+end:
+  if(client_name != NULL) krb5_free_unparsed_name(context, client_name);
+  if(owner != NULL) krb5_free_principal(context, owner);
+  return found;
+}
+
+// Copy the unexpired tickets of client from a snapshot file into ccache
+static int restore_snapshot(krb5_context context, const char* path, krb5_principal client, krb5_ccache ccache, krb5_creds* tgt) {
+  char name[4096];
+  krb5_ccache snapshot = NULL;
+  struct stat info;
+  int found;
+
+  // Only a file of our own nobody else could have written to
+  if(lstat(path, &info) != 0 || !S_ISREG(info.st_mode) || info.st_uid != geteuid()
+    || (info.st_mode & (S_IWGRP | S_IWOTH)) != 0) return 0;
+
+  snprintf(name, sizeof(name), "FILE:%s", path);
+  if(krb5_cc_resolve(context, name, &snapshot) != 0) return 0;
+
+  found = copy_tickets(context, snapshot, client, time(NULL) + SNAPSHOT_MIN_LIFETIME, ccache, tgt);
+  krb5_cc_close(context, snapshot);
+  return found;
+}
+
+// Shared ccaches are written by every process logged in to them. Each
+// service ticket fetch and each TGT refresh takes an flock of its own, named
+// after a hash of the ccache and of the service, so the first process asks
+// the KDC and the others wait and read the result.
+static unsigned long long name_hash(const char *name) {
+  // FNV-1a
+  unsigned long long hash = 14695981039346656037ULL;
+
+  for(; *name != 0; name++) {
+    hash ^= (unsigned char)*name;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// Prefix of the lock files of a shared ccache
+static char *lock_prefix_new(const char *lock_dir, const char *ccache_name) {
+  char prefix[4096];
+  char *copy;
+
+  snprintf(prefix, sizeof(prefix), "%s/kerberos-%016llx", lock_dir, name_hash(ccache_name));
+  copy = strdup(prefix);
+  if(copy == NULL) die1("Memory allocation failed");
+  return copy;
+}
+
+// Longest we wait for another process to finish a fetch before doing our own
+#define LOCK_WAIT_MS 10000
+#define LOCK_POLL_MS 10
+
+// Lock files live in a directory only we can write to, created 0700 when
+// missing. Anyone else able to create files there could hold our locks.
+static int lock_dir_ready(const char *lock_dir) {
+  struct stat info;
+
+  if(mkdir(lock_dir, S_IRWXU) != 0 && errno != EEXIST) return 0;
+  if(lstat(lock_dir, &info) != 0) return 0;
+
+  return S_ISDIR(info.st_mode) && info.st_uid == geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Waits a bounded time for the lock on what is ours, -1 if it could not be
+// taken. Going without only costs a duplicate fetch.
+static int lock_take(const char *prefix, const char *what) {
+  char path[4096];
+  struct stat info;
+  int waited = 0;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s-%016llx.lock", prefix, name_hash(what));
+  fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if(fd < 0) return -1;
+
+  // Only a file of our own
+  if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_uid != geteuid()) {
+    close(fd);
+    return -1;
+  }
+
+  while(flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    if((errno != EWOULDBLOCK && errno != EINTR) || waited >= LOCK_WAIT_MS) {
+      close(fd);
+      return -1;
+    }
+
+    usleep(LOCK_POLL_MS * 1000);
+    waited += LOCK_POLL_MS;
+  }
+
+  return fd;
+}
+
+static void lock_drop(int fd) {
+  // Closing lets go of the flock
+  if(fd >= 0) close(fd);
+}
+
+// Get a TGT into a new MEMORY ccache, or into the shared one when given.
+// Use a fresh enough TGT another process left in the shared ccache, renew
+// the one of previous while the KDC allows it, or start from a snapshot when
+// given one, and go back to the keytab otherwise.
+static gss_response *login_handle(const char* principal, const char* keytab, const char* snapshot, const char* shared, const char* lock_dir, gss_cred_handle* previous, gss_cred_handle** handle) {
+  OM_uint32 maj_stat;
+  OM_uint32 min_stat;
+  krb5_context context = NULL;
+  krb5_context creds_context = NULL;
+  krb5_principal client = NULL;
+  krb5_keytab kt = NULL;
+  krb5_ccache ccache = NULL;
+  krb5_creds creds;
+  gss_cred_id_t gss_cred = GSS_C_NO_CREDENTIAL;
+  gss_response *response = NULL;
+  krb5_error_code code;
+  char *lock_prefix = NULL;
+  char *full_name = NULL;
+  int lock = -1;
+  int reused = 0;
+
+  *handle = NULL;
+  memset(&creds, 0, sizeof(creds));
+
+  // Each handle has a context of its own, it is never used by two threads at once
+  code = krb5_init_context(&context);
+  if(code != 0) {
+    response = message_error("Failed to create a krb5 context");
+    goto end;
+  }
+
+  code = krb5_parse_name(context, principal, &client);
+  if(code != 0) {
+    response = krb5_error(context, code);
+    goto end;
+  }
+
+  if(shared != NULL) {
+    time_t cutoff = time(NULL) + SNAPSHOT_MIN_LIFETIME;
+
+    code = krb5_cc_resolve(context, shared, &ccache);
+    if(code != 0) {
+      response = krb5_error(context, code);
+      goto end;
+    }
+
+    if(!lock_dir_ready(lock_dir)) {
+      response = message_error("The lock directory must be a directory only the current user can write to");
+      goto end;
+    }
+
+    // One process at a time gets the TGT, the others take the one it left
+    lock_prefix = lock_prefix_new(lock_dir, shared);
+    lock = lock_take(lock_prefix, "krbtgt");
+    // A refresh wants newer tickets than the ones it replaces
+    if(previous != NULL && previous->expires >= cutoff) cutoff = previous->expires + 1;
+    if(copy_tickets(context, ccache, client, cutoff, NULL, &creds)) {
+      creds_context = context;
+      reused = 1;
+    }
+  } else {
+    // Nothing but this process ever sees the ccache
+    if((code = krb5_cc_new_unique(context, "MEMORY", NULL, &ccache)) != 0
+      || (code = krb5_cc_initialize(context, ccache, client)) != 0) {
+      response = krb5_error(context, code);
+      goto end;
+    }
+  }
+
+  // Service tickets of a previous process go straight in, an unexpired
+  // TGT saves the AS exchange
+  if(previous == NULL && snapshot != NULL && shared == NULL) {
+    if(restore_snapshot(context, snapshot, client, ccache, &creds))
+      creds_context = context;
+  }
+
+  // Carry the service tickets of a private ccache over, or the renewal
+  // would send every new context back to the KDC at once
+  if(previous != NULL && previous->krb5 != NULL && shared == NULL) {
+    krb5_creds old_tgt;
+
+    if(copy_tickets(previous->krb5, previous->ccache, client, time(NULL) + SNAPSHOT_MIN_LIFETIME, ccache, &old_tgt))
+      krb5_free_cred_contents(previous->krb5, &old_tgt);
+  }
+
+  // Renewing needs no keys, just the old TGT
+  if(creds_context == NULL && previous != NULL && previous->krb5 != NULL && previous->renew_till > time(NULL)) {
+    krb5_principal renew_client = NULL;
+
+    if(krb5_parse_name(previous->krb5, principal, &renew_client) == 0) {
+      if(krb5_get_renewed_creds(previous->krb5, &creds, renew_client, previous->ccache, NULL) == 0)
+        creds_context = previous->krb5;
+      krb5_free_principal(previous->krb5, renew_client);
+    }
+  }
+
+  // AS exchange with the KDC
+  if(creds_context == NULL) {
+    if((code = krb5_kt_resolve(context, keytab, &kt)) != 0
+      || (code = krb5_get_init_creds_keytab(context, &creds, client, kt, 0, NULL, NULL)) != 0) {
+      response = krb5_error(context, code);
+      goto end;
+    }
+    creds_context = context;
+  }
+
+  if(!reused) {
+    // A shared ccache keeps the service tickets of the other processes
+    // unless it was someone else's
+    if(shared != NULL) {
+      krb5_principal owner = NULL;
+
+      if(krb5_cc_get_principal(context, ccache, &owner) != 0 || !krb5_principal_compare(context, owner, client))
+        code = krb5_cc_initialize(context, ccache, client);
+      if(owner != NULL) krb5_free_principal(context, owner);
+    }
+
+    if(code == 0) code = krb5_cc_store_cred(context, ccache, &creds);
+    if(code != 0) {
+      response = krb5_error(context, code);
+      goto end;
+    }
+  }
+
+  maj_stat = gss_krb5_import_cred(&min_stat, ccache, client, NULL, &gss_cred);
+  if(GSS_ERROR(maj_stat)) {
+    response = gss_error(maj_stat, min_stat);
+    response->return_code = AUTH_GSS_ERROR;
+    goto end;
+  }
+
+  *handle = calloc(1, sizeof(gss_cred_handle));
+  if(*handle == NULL) die1("Memory allocation failed");
+  (*handle)->cred = gss_cred;
+  (*handle)->refs = 1;
+  (*handle)->krb5 = context;
+  (*handle)->ccache = ccache;
+  (*handle)->obtained = creds.times.starttime != 0 ? creds.times.starttime : creds.times.authtime;
+  (*handle)->expires = creds.times.endtime;
+  (*handle)->renew_till = creds.times.renew_till > creds.times.endtime ? creds.times.renew_till : 0;
+  (*handle)->lock_prefix = lock_prefix;
+  if(krb5_cc_get_full_name(context, ccache, &full_name) == 0) {
+    (*handle)->ccache_name = strdup(full_name);
+    if((*handle)->ccache_name == NULL) die1("Memory allocation failed");
+    krb5_free_string(context, full_name);
+  }
+  gss_cred = GSS_C_NO_CREDENTIAL;
+  lock_prefix = NULL;
+
+end:
+  if(gss_cred != GSS_C_NO_CREDENTIAL)
+    gss_release_cred(&min_stat, &gss_cred);
+  if(creds_context != NULL)
+    krb5_free_cred_contents(creds_context, &creds);
+  if(context != NULL) {
+    if(kt != NULL) krb5_kt_close(context, kt);
+    if(client != NULL) krb5_free_principal(context, client);
+
+    // On success the handle owns the context and the ccache
+    if(*handle == NULL) {
+      if(ccache != NULL) {
+        if(shared != NULL) {
+          krb5_cc_close(context, ccache);
+        } else {
+          krb5_cc_destroy(context, ccache);
+        }
+      }
+      krb5_free_context(context);
+    }
+  }
+  lock_drop(lock);
+  free(lock_prefix);
+
+  return response;
+}
+
+// Success response unless something failed
+static gss_response *complete_response(gss_response *response) {
+  if(response == NULL) {
+    response = calloc(1, sizeof(gss_response));
+    if(response == NULL) die1("Memory allocation failed");
+    response->return_code = AUTH_GSS_COMPLETE;
+  }
+
+  return response;
+}
+
+gss_response *authenticate_gss_cred_acquire(const char* principal, const char* password, gss_client_cred** cred) {
+  gss_cred_handle *handle = NULL;
+  char *display = NULL;
+  gss_response *response;
+
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CRED_ACQUIRE, cred, 0);
+
+  *cred = NULL;
+  response = acquire_handle(principal, password, &handle, &display);
+  if(response == NULL)
+    *cred = cred_new(display, NULL, password != NULL, handle);
+
+  response = complete_response(response);
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CRED_ACQUIRE, cred, response->return_code, response->major_status, response->minor_status);
+  return response;
+}
+
+gss_response *authenticate_gss_cred_login(const char* principal, const char* keytab, const char* snapshot, const char* shared, const char* lock_dir, gss_client_cred** cred) {
+  gss_cred_handle *handle = NULL;
+  gss_response *response;
+
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CRED_ACQUIRE, cred, 0);
+
+  *cred = NULL;
+  response = login_handle(principal, keytab, snapshot, shared, lock_dir, NULL, &handle);
+  if(response == NULL) {
+    char *principal_copy = strdup(principal);
+    char *keytab_copy = strdup(keytab);
+    if(principal_copy == NULL || keytab_copy == NULL) die1("Memory allocation failed");
+    *cred = cred_new(principal_copy, keytab_copy, 0, handle);
+
+    if(shared != NULL) {
+      (*cred)->shared = strdup(shared);
+      (*cred)->lock_dir = strdup(lock_dir);
+      if((*cred)->shared == NULL || (*cred)->lock_dir == NULL) die1("Memory allocation failed");
+    }
+  }
+
+  response = complete_response(response);
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CRED_ACQUIRE, cred, response->return_code, response->major_status, response->minor_status);
+  return response;
+}
+
+gss_response *authenticate_gss_cred_refresh(gss_client_cred* cred) {
+  gss_cred_handle *current;
+  gss_cred_handle *fresh = NULL;
+  gss_response *response = NULL;
+
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CRED_REFRESH, cred, 0);
+
+  // One refresh at a time, it is the only user of the handle krb5 contexts
+  pthread_mutex_lock(&cred->refresh_lock);
+  current = cred_borrow(cred);
+
+  if(cred->password) {
+    response = message_error("Password credentials can't be renewed, acquire them again");
+  } else if(cred->keytab != NULL) {
+    response = login_handle(cred->principal, cred->keytab, NULL, cred->shared, cred->lock_dir, current, &fresh);
+  } else {
+    // Picks up whatever kinit or the like left in the ccache
+    response = acquire_handle(cred->principal, NULL, &fresh, NULL);
+  }
+
+  // Steps still using the old handle keep it until they return
+  if(fresh != NULL) {
+    pthread_mutex_lock(&cred->lock);
+    cred->handle = fresh;
+    pthread_mutex_unlock(&cred->lock);
+    handle_release(current);
+  }
+
+  handle_release(current);
+  pthread_mutex_unlock(&cred->refresh_lock);
+
+  response = complete_response(response);
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CRED_REFRESH, cred, response->return_code, response->major_status, response->minor_status);
+  return response;
+}
+
+gss_response *authenticate_gss_cred_save(gss_client_cred* cred, const char* path) {
+  gss_cred_handle *handle;
+  krb5_context context = NULL;
+  krb5_ccache source = NULL;
+  krb5_ccache snapshot = NULL;
+  krb5_principal client = NULL;
+  krb5_cc_cursor cursor;
+  krb5_creds entry;
+  krb5_error_code code;
+  gss_response *response = NULL;
+  char name[4096];
+  char temporary[4096];
+  time_t cutoff = time(NULL) + SNAPSHOT_MIN_LIFETIME;
+
+  // Runs on the loop thread, so the ccache is opened by name in a context
+  // of our own rather than wait on a refresh for the handle's
+  handle = cred_borrow(cred);
+
+  if(handle->krb5 == NULL || handle->ccache_name == NULL) {
+    response = message_error("Only keytab logins have a ccache of their own to snapshot");
+    goto end;
+  }
+
+  if(krb5_init_context(&context) != 0) {
+    context = NULL;
+    response = message_error("Failed to create a krb5 context");
+    goto end;
+  }
+
+  if((code = krb5_cc_resolve(context, handle->ccache_name, &source)) != 0) {
+    response = krb5_error(context, code);
+    goto end;
+  }
+
+  // Written next to the target and renamed over it, readers never see half a file
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+  snprintf(name, sizeof(name), "FILE:%s", temporary);
+  unlink(temporary);
+
+  if((code = krb5_cc_get_principal(context, source, &client)) != 0
+    || (code = krb5_cc_resolve(context, name, &snapshot)) != 0
+    || (code = krb5_cc_initialize(context, snapshot, client)) != 0) {
+    response = krb5_error(context, code);
+    goto end;
+  }
+
+  // The tickets are as good as the keytab, owner only
+  if(chmod(temporary, S_IRUSR | S_IWUSR) != 0) {
+    response = message_error("Failed to restrict the snapshot file permissions");
+    goto end;
+  }
+
+  if((code = krb5_cc_start_seq_get(context, source, &cursor)) != 0) {
+    response = krb5_error(context, code);
+    goto end;
+  }
+  while(krb5_cc_next_cred(context, source, &cursor, &entry) == 0) {
+    if(entry.times.endtime > cutoff && !krb5_is_config_principal(context, entry.server))
+      code = krb5_cc_store_cred(context, snapshot, &entry);
+    krb5_free_cred_contents(context, &entry);
+    if(code != 0) break;
+  }
+  krb5_cc_end_seq_get(context, source, &cursor);
+
+  if(code != 0) {
+    response = krb5_error(context, code);
+    goto end;
+  }
+
+  krb5_cc_close(context, snapshot);
+  snapshot = NULL;
+  if(rename(temporary, path) != 0) {
+    response = message_error("Failed to move the snapshot file in place");
+    goto end;
+  }
+
+end:
+  if(snapshot != NULL) {
+    krb5_cc_close(context, snapshot);
+    unlink(temporary);
+  }
+  if(client != NULL) krb5_free_principal(context, client);
+  // Closing leaves the MEMORY ccache to the handle
+  if(source != NULL) krb5_cc_close(context, source);
+  if(context != NULL) krb5_free_context(context);
+  handle_release(handle);
+
+  return complete_response(response);
+}
+
+char *authenticate_gss_cred_ccache_name(gss_client_cred* cred) {
+  gss_cred_handle *handle = cred_borrow(cred);
+  char *name = NULL;
+
+  if(handle->ccache_name != NULL) {
+    name = strdup(handle->ccache_name);
+    if(name == NULL) die1("Memory allocation failed");
+  }
+
+  handle_release(handle);
+  return name;
+}
+
+void authenticate_gss_cred_times(gss_client_cred* cred, time_t* obtained, time_t* expires) {
+  pthread_mutex_lock(&cred->lock);
+  *obtained = cred->handle->obtained;
+  *expires = cred->handle->expires;
+  pthread_mutex_unlock(&cred->lock);
+}
+
+// References are taken and dropped from the loop and the worker threads
+void authenticate_gss_cred_retain(gss_client_cred* cred) {
+  __sync_fetch_and_add(&cred->refs, 1);
+}
+
+void authenticate_gss_cred_release(gss_client_cred* cred) {
+  if(__sync_sub_and_fetch(&cred->refs, 1) > 0) return;
+
+  handle_release(cred->handle);
+  pthread_mutex_destroy(&cred->lock);
+  pthread_mutex_destroy(&cred->refresh_lock);
+  free(cred->principal);
+  free(cred->keytab);
+  free(cred->shared);
+  free(cred->lock_dir);
+  free(cred);
+}
+
+gss_response *authenticate_gss_client_init(const char* service, long int gss_flags, int mech, gss_client_cred* cred, gss_client_state* state) {
+  OM_uint32 maj_stat;
+  OM_uint32 min_stat;
   gss_response *response = NULL;
   int ret = AUTH_GSS_COMPLETE;
 
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CLIENT_INIT, state, 0);
+
   state->server_name = GSS_C_NO_NAME;
+  state->service = NULL;
+  state->cred = NULL;
   state->context = GSS_C_NO_CONTEXT;
   state->gss_flags = gss_flags;
+  state->mech = mech;
   state->username = NULL;
   state->response = NULL;
+  state->response_token.value = NULL;
+  state->response_token.length = 0;
+  state->response_format = AUTH_GSS_RESPONSE_BASE64;
+  state->established = 0;
+  state->ret_flags = 0;
+  state->expires = 0;
 
-  // Import server name first
-  name_token.length = strlen(service);
-  name_token.value = (char *)service;
-
-  maj_stat = gss_import_name(&min_stat, &name_token, gss_krb5_nt_service_name, &state->server_name);
+  // Copy the server name from the interned one
+  maj_stat = import_service_name(&min_stat, service, &state->server_name);
 
   if (GSS_ERROR(maj_stat)) {
     response = gss_error(maj_stat, min_stat);
@@ -62,6 +950,16 @@ gss_response *authenticate_gss_client_init(const char* service, long int gss_fla
     goto end;
   }
 
+  // Fetches of the ticket are coalesced by service
+  state->service = strdup(service);
+  if(state->service == NULL) die1("Memory allocation failed");
+
+  // Hold on to the shared credentials, the default ones are looked up per step
+  if(cred != NULL) {
+    authenticate_gss_cred_retain(cred);
+    state->cred = cred;
+  }
+
 end:
   if(response == NULL) {
     response = calloc(1, sizeof(gss_response));
@@ -69,6 +967,274 @@ end:
     response->return_code = ret;
   }
 
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CLIENT_INIT, state, response->return_code, response->major_status, response->minor_status);
+  return response;
+}
+
+// Service ticket fetches per (credentials, service). The first leg of a
+// context sends a TGS-REQ unless the ticket is in the ccache already, so a
+// burst of new contexts to one service would all ask the KDC for the same
+// ticket. Instead the first one fetches it while the others wait, then
+// find it in the ccache.
+#define TICKET_FLIGHT_MAX 256
+// Most seconds we take a fetched ticket to still be in the ccache, less when
+// the ticket runs out sooner. Being wrong costs the coalescing, never a
+// handshake.
+#define TICKET_FLIGHT_TTL 300
+
+typedef struct ticket_flight {
+  char *service;
+  // Handle whose ccache gets the ticket, NULL for the default ccache. Only
+  // ever compared, a new handle at a freed one's address just misses.
+  const void *owner;
+  int fetching;
+  time_t fetched_until;
+  struct ticket_flight *next;
+} ticket_flight;
+
+static pthread_mutex_t flight_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Shared by all flights, a broadcast only happens once per fetch
+static pthread_cond_t flight_cond = PTHREAD_COND_INITIALIZER;
+// Most recently added first
+static ticket_flight *flights = NULL;
+static int flight_count = 0;
+// First legs that waited for another one's fetch
+static unsigned long flight_waits = 0;
+
+static ticket_flight *flight_find(const char *service, const void *owner) {
+  ticket_flight *flight;
+
+  for(flight = flights; flight != NULL; flight = flight->next) {
+    if(flight->owner == owner && strcmp(flight->service, service) == 0) break;
+  }
+
+  return flight;
+}
+
+// Add an entry, making room by dropping the oldest idle one. NULL when all
+// are being fetched.
+static ticket_flight *flight_add(const char *service, const void *owner) {
+  ticket_flight *flight;
+
+  if(flight_count >= TICKET_FLIGHT_MAX) {
+    ticket_flight **link;
+    ticket_flight **idle = NULL;
+
+    for(link = &flights; *link != NULL; link = &(*link)->next) {
+      if(!(*link)->fetching) idle = link;
+    }
+    if(idle == NULL) return NULL;
+
+    flight = *idle;
+    *idle = flight->next;
+    free(flight->service);
+    free(flight);
+    flight_count--;
+  }
+
+  flight = calloc(1, sizeof(ticket_flight));
+  if(flight == NULL) die1("Memory allocation failed");
+  flight->service = strdup(service);
+  if(flight->service == NULL) die1("Memory allocation failed");
+  flight->owner = owner;
+  flight->next = flights;
+  flights = flight;
+  flight_count++;
+  return flight;
+}
+
+// Wait while another thread fetches the ticket. Returns the flight to end
+// when the caller is to fetch it, NULL when it should be in the ccache.
+static ticket_flight *flight_begin(const char *service, const void *owner) {
+  ticket_flight *flight;
+  int waited = 0;
+
+  pthread_mutex_lock(&flight_mutex);
+  for(;;) {
+    flight = flight_find(service, owner);
+    if(flight == NULL || !flight->fetching) break;
+
+    if(!waited) flight_waits++;
+    waited = 1;
+    pthread_cond_wait(&flight_cond, &flight_mutex);
+  }
+
+  if(flight != NULL && flight->fetched_until > time(NULL)) {
+    flight = NULL;
+  } else {
+    if(flight == NULL) flight = flight_add(service, owner);
+    if(flight != NULL) flight->fetching = 1;
+  }
+  pthread_mutex_unlock(&flight_mutex);
+
+  return flight;
+}
+
+// Wake the waiters, on failure one of them tries next. lifetime is the
+// time_rec of the first leg, which for krb5 is what the ticket has left.
+static void flight_end(ticket_flight *flight, int fetched, OM_uint32 lifetime) {
+  if(lifetime > TICKET_FLIGHT_TTL) lifetime = TICKET_FLIGHT_TTL;
+
+  pthread_mutex_lock(&flight_mutex);
+  flight->fetching = 0;
+  flight->fetched_until = fetched ? time(NULL) + lifetime : 0;
+  pthread_cond_broadcast(&flight_cond);
+  pthread_mutex_unlock(&flight_mutex);
+}
+
+unsigned long authenticate_gss_client_coalesced(void) {
+  unsigned long waits;
+
+  pthread_mutex_lock(&flight_mutex);
+  waits = flight_waits;
+  pthread_mutex_unlock(&flight_mutex);
+
+  return waits;
+}
+
+// Least seconds a ticket must have left for a step to count on it
+#define CACHED_MIN_LIFETIME 10
+
+// Context of the ccache lookups made on the loop thread, the handle
+// contexts belong to the workers
+static pthread_mutex_t lookup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static krb5_context lookup_context = NULL;
+
+// Is a ticket for server in the named ccache, the default one for NULL.
+// Costs whatever a ccache read does, file I/O or KCM IPC included, and
+// lookups from all threads take turns.
+static int ticket_in_ccache(const char *ccache_name, gss_name_t server) {
+  OM_uint32 min_stat;
+  gss_buffer_desc display = GSS_C_EMPTY_BUFFER;
+  gss_OID name_type = GSS_C_NO_OID;
+  krb5_context context;
+  krb5_ccache ccache = NULL;
+  krb5_creds mcreds;
+  krb5_creds creds;
+  char *principal;
+  int found = 0;
+
+  // Only names the krb5 mech canonicalized spell out the principal
+  if(GSS_ERROR(gss_display_name(&min_stat, server, &display, &name_type))) return 0;
+  if(name_type == GSS_C_NO_OID || name_type->length != GSS_KRB5_NT_PRINCIPAL_NAME->length
+    || memcmp(name_type->elements, GSS_KRB5_NT_PRINCIPAL_NAME->elements, name_type->length) != 0) {
+    gss_release_buffer(&min_stat, &display);
+    return 0;
+  }
+
+  principal = malloc(display.length + 1);
+  if(principal == NULL) die1("Memory allocation failed");
+  memcpy(principal, display.value, display.length);
+  principal[display.length] = 0;
+  gss_release_buffer(&min_stat, &display);
+
+  memset(&mcreds, 0, sizeof(mcreds));
+
+  pthread_mutex_lock(&lookup_mutex);
+  if(lookup_context == NULL && krb5_init_context(&context) == 0) lookup_context = context;
+  context = lookup_context;
+
+  if(context != NULL
+    && (ccache_name != NULL ? krb5_cc_resolve(context, ccache_name, &ccache) : krb5_cc_default(context, &ccache)) == 0) {
+    // The realm may have been left to referrals, the ticket carries the real one
+    if(krb5_cc_get_principal(context, ccache, &mcreds.client) == 0
+      && krb5_parse_name(context, principal, &mcreds.server) == 0) {
+      mcreds.times.endtime = time(NULL) + CACHED_MIN_LIFETIME;
+      if(krb5_cc_retrieve_cred(context, ccache, KRB5_TC_MATCH_TIMES | KRB5_TC_MATCH_SRV_NAMEONLY, &mcreds, &creds) == 0) {
+        krb5_free_cred_contents(context, &creds);
+        found = 1;
+      }
+    }
+
+    if(mcreds.client != NULL) krb5_free_principal(context, mcreds.client);
+    if(mcreds.server != NULL) krb5_free_principal(context, mcreds.server);
+    krb5_cc_close(context, ccache);
+  }
+  pthread_mutex_unlock(&lookup_mutex);
+
+  free(principal);
+  return found;
+}
+
+// Will the next step of state get by without the KDC using handle
+static int step_cached(gss_client_state *state, gss_cred_handle *handle) {
+  // Only the first leg ever talks to the KDC
+  if(state->context != GSS_C_NO_CONTEXT) return 1;
+  // Delegating fetches a forwarded TGT to send along
+  if(state->gss_flags & GSS_C_DELEG_FLAG) return 0;
+  // Password credentials keep their ccache inside GSSAPI
+  if(handle != NULL && handle->ccache_name == NULL) return 0;
+
+  return ticket_in_ccache(handle != NULL ? handle->ccache_name : NULL, state->server_name);
+}
+
+gss_response *authenticate_gss_client_prefetch(const char* service, gss_client_cred* cred) {
+  OM_uint32 maj_stat;
+  OM_uint32 min_stat;
+  gss_name_t server_name = GSS_C_NO_NAME;
+  gss_ctx_id_t context = GSS_C_NO_CONTEXT;
+  gss_buffer_desc output_token = GSS_C_EMPTY_BUFFER;
+  gss_cred_handle *handle = NULL;
+  ticket_flight *flight;
+  gss_response *response = NULL;
+  int lock = -1;
+  OM_uint32 time_rec = 0;
+
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CLIENT_PREFETCH, service, 0);
+
+  // Also interns the name for the contexts to come
+  maj_stat = import_service_name(&min_stat, service, &server_name);
+  if(GSS_ERROR(maj_stat)) {
+    response = gss_error(maj_stat, min_stat);
+    response->return_code = AUTH_GSS_ERROR;
+    goto end;
+  }
+
+  if(cred != NULL) handle = cred_borrow(cred);
+  flight = flight_begin(service, handle);
+  if(flight != NULL && handle != NULL && handle->lock_prefix != NULL) lock = lock_take(handle->lock_prefix, service);
+
+  // The first leg gets the service ticket into the ccache, the token and
+  // the context are thrown away
+  maj_stat = gss_init_sec_context(&min_stat,
+                                  handle != NULL ? handle->cred : GSS_C_NO_CREDENTIAL,
+                                  &context,
+                                  server_name,
+                                  GSS_C_NO_OID,
+                                  0,
+                                  0,
+                                  GSS_C_NO_CHANNEL_BINDINGS,
+                                  GSS_C_NO_BUFFER,
+                                  NULL,
+                                  &output_token,
+                                  NULL,
+                                  &time_rec);
+
+  lock_drop(lock);
+  if(flight != NULL) flight_end(flight, !GSS_ERROR(maj_stat), time_rec);
+  if(handle != NULL) handle_release(handle);
+
+  if(GSS_ERROR(maj_stat)) {
+    response = gss_error(maj_stat, min_stat);
+    response->return_code = AUTH_GSS_ERROR;
+    goto end;
+  }
+
+end:
+  if(output_token.value != NULL)
+    gss_release_buffer(&min_stat, &output_token);
+  if(context != GSS_C_NO_CONTEXT)
+    gss_delete_sec_context(&min_stat, &context, GSS_C_NO_BUFFER);
+  if(server_name != GSS_C_NO_NAME)
+    gss_release_name(&min_stat, &server_name);
+
+  if(response == NULL) {
+    response = calloc(1, sizeof(gss_response));
+    if(response == NULL) die1("Memory allocation failed");
+    response->return_code = AUTH_GSS_COMPLETE;
+  }
+
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CLIENT_PREFETCH, service, response->return_code, response->major_status, response->minor_status);
   return response;
 }
 
@@ -77,21 +1243,30 @@ gss_response *authenticate_gss_client_clean(gss_client_state *state) {
   int ret = AUTH_GSS_COMPLETE;
   gss_response *response = NULL;
 
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CLIENT_CLEAN, state, 0);
+
   if(state->context != GSS_C_NO_CONTEXT)
     gss_delete_sec_context(&min_stat, &state->context, GSS_C_NO_BUFFER);
 
   if(state->server_name != GSS_C_NO_NAME)
     gss_release_name(&min_stat, &state->server_name);
 
+  if(state->service != NULL) {
+    free(state->service);
+    state->service = NULL;
+  }
+
+  if(state->cred != NULL) {
+    authenticate_gss_cred_release(state->cred);
+    state->cred = NULL;
+  }
+
   if(state->username != NULL) {
     free(state->username);
     state->username = NULL;
   }
 
-  if (state->response != NULL) {
-    free(state->response);
-    state->response = NULL;
-  }
+  clear_response(&state->response, &state->response_token);
 
   if(response == NULL) {
     response = calloc(1, sizeof(gss_response));
@@ -99,44 +1274,68 @@ gss_response *authenticate_gss_client_clean(gss_client_state *state) {
     response->return_code = ret;
   }
 
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CLIENT_CLEAN, state, response->return_code, response->major_status, response->minor_status);
   return response;
 }
 
-gss_response *authenticate_gss_client_step(gss_client_state* state, const char* challenge) {
+// With no_fetch the step returns NULL rather than fetch the service ticket
+static gss_response *client_step(gss_client_state* state, const unsigned char* token, size_t token_len, int no_fetch) {
   OM_uint32 maj_stat;
   OM_uint32 min_stat;
   gss_buffer_desc input_token = GSS_C_EMPTY_BUFFER;
   gss_buffer_desc output_token = GSS_C_EMPTY_BUFFER;
   int ret = AUTH_GSS_CONTINUE;
   gss_response *response = NULL;
+  gss_cred_handle *handle = NULL;
+  ticket_flight *flight = NULL;
+  int lock = -1;
+  OM_uint32 ret_flags = 0;
+  OM_uint32 time_rec = 0;
+
+  // Hold the current credentials for the call, a renewal may replace them
+  if(state->cred != NULL) handle = cred_borrow(state->cred);
+
+  // Checked against the ccache of the handle the step will use
+  if(no_fetch && !step_cached(state, handle)) {
+    if(handle != NULL) handle_release(handle);
+    return NULL;
+  }
+
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CLIENT_STEP, state, token_len);
 
   // Always clear out the old response
-  if (state->response != NULL) {
-    free(state->response);
-    state->response = NULL;
-  }
+  clear_response(&state->response, &state->response_token);
 
   // If there is a challenge (data from the server) we need to give it to GSS
-  if (challenge && *challenge) {
-    int len;
-    input_token.value = base64_decode(challenge, &len);
-    input_token.length = len;
+  if (token_len > 0) {
+    input_token.value = (void *)token;
+    input_token.length = token_len;
   }
 
+  // The first leg may have to fetch the service ticket, unless it is known
+  // to be in the ccache
+  if(state->context == GSS_C_NO_CONTEXT && !no_fetch) flight = flight_begin(state->service, handle);
+  // and so may other processes on a shared ccache
+  if(flight != NULL && handle != NULL && handle->lock_prefix != NULL) lock = lock_take(handle->lock_prefix, state->service);
+
   // Do GSSAPI step
   maj_stat = gss_init_sec_context(&min_stat,
-                                  GSS_C_NO_CREDENTIAL,
+                                  handle != NULL ? handle->cred : GSS_C_NO_CREDENTIAL,
                                   &state->context,
                                   state->server_name,
-                                  GSS_C_NO_OID,
+                                  mech_oid(state->mech),
                                   (OM_uint32)state->gss_flags,
                                   0,
                                   GSS_C_NO_CHANNEL_BINDINGS,
                                   &input_token,
                                   NULL,
                                   &output_token,
-                                  NULL,
-                                  NULL);
+                                  &ret_flags,
+                                  &time_rec);
+
+  lock_drop(lock);
+  if(flight != NULL) flight_end(flight, !GSS_ERROR(maj_stat), time_rec);
+  if(handle != NULL) handle_release(handle);
 
   if ((maj_stat != GSS_S_COMPLETE) && (maj_stat != GSS_S_CONTINUE_NEEDED)) {
     response = gss_error(maj_stat, min_stat);
@@ -147,13 +1346,17 @@ gss_response *authenticate_gss_client_step(gss_client_state* state, const char*
   ret = (maj_stat == GSS_S_COMPLETE) ? AUTH_GSS_COMPLETE : AUTH_GSS_CONTINUE;
   // Grab the client response to send back to the server
   if(output_token.length) {
-    state->response = base64_encode((const unsigned char *)output_token.value, output_token.length);
-    maj_stat = gss_release_buffer(&min_stat, &output_token);
+    set_response(state->response_format, &output_token, &state->response, &state->response_token);
   }
 
   // Try to get the user name if we have completed all GSS operations
   if (ret == AUTH_GSS_COMPLETE) {
     gss_name_t gssuser = GSS_C_NO_NAME;
+
+    state->established = 1;
+    state->ret_flags = ret_flags;
+    state->expires = context_expiry(time_rec);
+
     maj_stat = gss_inquire_context(&min_stat, state->context, &gssuser, NULL, NULL, NULL,  NULL, NULL, NULL);
 
     if(GSS_ERROR(maj_stat)) {
@@ -187,8 +1390,6 @@ gss_response *authenticate_gss_client_step(gss_client_state* state, const char*
 end:
   if(output_token.value)
     gss_release_buffer(&min_stat, &output_token);
-  if(input_token.value)
-    free(input_token.value);
 
   if(response == NULL) {
     response = calloc(1, sizeof(gss_response));
@@ -196,11 +1397,20 @@ end:
     response->return_code = ret;
   }
 
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CLIENT_STEP, state, response->return_code, response->major_status, response->minor_status);
   // Return the response
   return response;
 }
 
-gss_response *authenticate_gss_client_unwrap(gss_client_state *state, const char *challenge) {
+gss_response *authenticate_gss_client_step(gss_client_state* state, const unsigned char* token, size_t token_len) {
+  return client_step(state, token, token_len, 0);
+}
+
+gss_response *authenticate_gss_client_step_cached(gss_client_state* state, const unsigned char* token, size_t token_len) {
+  return client_step(state, token, token_len, 1);
+}
+
+gss_response *authenticate_gss_client_unwrap(gss_client_state *state, const unsigned char *token, size_t token_len) {
   OM_uint32 maj_stat;
   OM_uint32 min_stat;
   gss_buffer_desc input_token = GSS_C_EMPTY_BUFFER;
@@ -208,17 +1418,15 @@ gss_response *authenticate_gss_client_unwrap(gss_client_state *state, const char
   gss_response *response = NULL;
   int ret = AUTH_GSS_CONTINUE;
 
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CLIENT_UNWRAP, state, token_len);
+
   // Always clear out the old response
-  if(state->response != NULL) {
-    free(state->response);
-    state->response = NULL;
-  }
+  clear_response(&state->response, &state->response_token);
 
   // If there is a challenge (data from the server) we need to give it to GSS
-  if(challenge && *challenge) {
-    int len;
-    input_token.value = base64_decode(challenge, &len);
-    input_token.length = len;
+  if(token_len > 0) {
+    input_token.value = (void *)token;
+    input_token.length = token_len;
   }
 
   // Do GSSAPI step
@@ -239,14 +1447,11 @@ gss_response *authenticate_gss_client_unwrap(gss_client_state *state, const char
 
   // Grab the client response
   if(output_token.length) {
-    state->response = base64_encode((const unsigned char *)output_token.value, output_token.length);
-    gss_release_buffer(&min_stat, &output_token);
+    set_response(state->response_format, &output_token, &state->response, &state->response_token);
   }
 end:
   if(output_token.value)
     gss_release_buffer(&min_stat, &output_token);
-  if(input_token.value)
-    free(input_token.value);
 
   if(response == NULL) {
     response = calloc(1, sizeof(gss_response));
@@ -254,11 +1459,12 @@ end:
     response->return_code = ret;
   }
 
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CLIENT_UNWRAP, state, response->return_code, response->major_status, response->minor_status);
   // Return the response
   return response;
 }
 
-gss_response *authenticate_gss_client_wrap(gss_client_state* state, const char* challenge, const char* user) {
+gss_response *authenticate_gss_client_wrap(gss_client_state* state, const unsigned char* token, size_t token_len, const char* user) {
   OM_uint32 maj_stat;
   OM_uint32 min_stat;
   gss_buffer_desc input_token = GSS_C_EMPTY_BUFFER;
@@ -268,24 +1474,29 @@ gss_response *authenticate_gss_client_wrap(gss_client_state* state, const char*
   char buf[4096], server_conf_flags;
   unsigned long buf_size;
 
+  KERBEROS_PROBE3(gss_entry, KERBEROS_OP_CLIENT_WRAP, state, token_len);
+
   // Always clear out the old response
-  if(state->response != NULL) {
-    free(state->response);
-    state->response = NULL;
-  }
+  clear_response(&state->response, &state->response_token);
 
-  if(challenge && *challenge) {
-    int len;
-    input_token.value = base64_decode(challenge, &len);
-    input_token.length = len;
+  if(token_len > 0) {
+    input_token.value = (void *)token;
+    input_token.length = token_len;
   }
 
   if(user) {
+    // The server's security layer offer is 1 byte of flags and a 3 byte size
+    if(token_len < 4) {
+      response = calloc(1, sizeof(gss_response));
+      if(response == NULL) die1("Memory allocation failed");
+      response->message = "Security layer token from server is too short";
+      response->return_code = AUTH_GSS_ERROR;
+      goto end;
+    }
+
     // get bufsize
-    server_conf_flags = ((char*) input_token.value)[0];
-    ((char*) input_token.value)[0] = 0;
-    buf_size = ntohl(*((long *) input_token.value));
-    free(input_token.value);
+    server_conf_flags = (char)token[0];
+    buf_size = ((unsigned long)token[1] << 16) | ((unsigned long)token[2] << 8) | token[3];
 #ifdef PRINTFS
     printf("User: %s, %c%c%c\n", user,
                server_conf_flags & GSS_AUTH_P_NONE      ? 'N' : '-',
@@ -321,8 +1532,7 @@ gss_response *authenticate_gss_client_wrap(gss_client_state* state, const char*
     ret = AUTH_GSS_COMPLETE;
   // Grab the client response to send back to the server
   if (output_token.length) {
-    state->response = base64_encode((const unsigned char *)output_token.value, output_token.length);;
-    gss_release_buffer(&min_stat, &output_token);
+    set_response(state->response_format, &output_token, &state->response, &state->response_token);
   }
 end:
   if (output_token.value)
@@ -334,18 +1544,226 @@ end:
     response->return_code = ret;
   }
 
+  KERBEROS_PROBE5(gss_return, KERBEROS_OP_CLIENT_WRAP, state, response->return_code, response->major_status, response->minor_status);
   // Return the response
   return response;
 }
 
-gss_response *authenticate_gss_server_init(const char *service, gss_server_state *state)
+// Acceptor credentials of one service, shared by its server states. The
+// cache holds one reference while the entry is listed, every state using
+// it one more.
+typedef struct acceptor_cred {
+    char *service;
+    int mech;
+    gss_name_t name;
+    gss_cred_id_t cred;
+    time_t expires;
+    int refs;
+    struct acceptor_cred *next;
+} acceptor_cred;
+
+static pthread_mutex_t acceptor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static acceptor_cred *acceptor_creds = NULL;
+// Seconds an entry is used before the keytab is read again
+static int acceptor_cred_ttl = 300;
+
+static void acceptor_cred_free(acceptor_cred *entry)
 {
-    OM_uint32 maj_stat;
     OM_uint32 min_stat;
+
+    if (entry->cred != GSS_C_NO_CREDENTIAL)
+        gss_release_cred(&min_stat, &entry->cred);
+    if (entry->name != GSS_C_NO_NAME)
+        gss_release_name(&min_stat, &entry->name);
+    free(entry->service);
+    free(entry);
+}
+
+// Drop a reference, freeing the entry with the last one
+static void acceptor_cred_release(acceptor_cred *entry)
+{
+    int refs;
+
+    pthread_mutex_lock(&acceptor_mutex);
+    refs = --entry->refs;
+    pthread_mutex_unlock(&acceptor_mutex);
+
+    if (refs == 0)
+        acceptor_cred_free(entry);
+}
+
+// Unlink entries for service (all of them for NULL), or only the expired
+// ones. Returns them linked through next for the caller to release outside
+// the lock. Must hold acceptor_mutex.
+static acceptor_cred *acceptor_cred_unlink(const char *service, int expired_only, time_t now)
+{
+    acceptor_cred **link = &acceptor_creds;
+    acceptor_cred *unlinked = NULL;
+
+    while (*link != NULL)
+    {
+        acceptor_cred *entry = *link;
+        int match = expired_only ? entry->expires <= now
+            : (service == NULL || strcmp(entry->service, service) == 0);
+
+        if (match)
+        {
+            *link = entry->next;
+            entry->next = unlinked;
+            unlinked = entry;
+        }
+        else
+        {
+            link = &entry->next;
+        }
+    }
+
+    return unlinked;
+}
+
+static void acceptor_cred_release_list(acceptor_cred *entry)
+{
+    while (entry != NULL)
+    {
+        acceptor_cred *next = entry->next;
+        acceptor_cred_release(entry);
+        entry = next;
+    }
+}
+
+// Borrow the acceptor credentials for service, importing the name and
+// acquiring them on a miss. The lock is not held while GSS reads the
+// keytab, two racing misses both acquire and the loser drops its copy.
+static acceptor_cred *acceptor_cred_get(const char *service, int mech, OM_uint32 *maj_stat, OM_uint32 *min_stat)
+{
     gss_buffer_desc name_token = GSS_C_EMPTY_BUFFER;
+    gss_OID_set_desc mechs;
+    acceptor_cred *entry;
+    acceptor_cred *existing;
+    acceptor_cred *expired;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&acceptor_mutex);
+    expired = acceptor_cred_unlink(NULL, 1, now);
+    for (entry = acceptor_creds; entry != NULL; entry = entry->next)
+    {
+        if (entry->mech == mech && strcmp(entry->service, service) == 0)
+        {
+            entry->refs++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&acceptor_mutex);
+
+    acceptor_cred_release_list(expired);
+    if (entry != NULL)
+        return entry;
+
+    entry = calloc(1, sizeof(acceptor_cred));
+    if (entry == NULL) die1("Memory allocation failed");
+    entry->service = strdup(service);
+    if (entry->service == NULL) die1("Memory allocation failed");
+    entry->mech = mech;
+    entry->name = GSS_C_NO_NAME;
+    entry->cred = GSS_C_NO_CREDENTIAL;
+
+    // Import server name first, without one any keytab entry will do
+    if (service[0] != 0)
+    {
+        name_token.length = strlen(service);
+        name_token.value = (char *)service;
+
+        *maj_stat = gss_import_name(min_stat, &name_token, GSS_C_NT_HOSTBASED_SERVICE, &entry->name);
+        if (GSS_ERROR(*maj_stat))
+        {
+            acceptor_cred_free(entry);
+            return NULL;
+        }
+    }
+
+    // Get credentials, for the one mechanism when asked to
+    mechs.count = 1;
+    mechs.elements = mech_oid(mech);
+    *maj_stat = gss_acquire_cred(min_stat, entry->name, GSS_C_INDEFINITE,
+                                 mech == AUTH_GSS_MECH_DEFAULT ? GSS_C_NO_OID_SET : &mechs,
+                                 GSS_C_ACCEPT, &entry->cred, NULL, NULL);
+    if (GSS_ERROR(*maj_stat))
+    {
+        acceptor_cred_free(entry);
+        return NULL;
+    }
+
+#ifdef KERBEROS_HAVE_NEG_MECHS
+    // SPNEGO only offers krb5, so there is nothing left to negotiate
+    if (mech == AUTH_GSS_MECH_SPNEGO)
+    {
+        mechs.elements = gss_mech_krb5;
+        *maj_stat = gss_set_neg_mechs(min_stat, entry->cred, &mechs);
+        if (GSS_ERROR(*maj_stat))
+        {
+            acceptor_cred_free(entry);
+            return NULL;
+        }
+    }
+#endif
+
+    entry->expires = now + acceptor_cred_ttl;
+    entry->refs = 2;
+
+    pthread_mutex_lock(&acceptor_mutex);
+    for (existing = acceptor_creds; existing != NULL; existing = existing->next)
+    {
+        if (existing->mech == mech && strcmp(existing->service, service) == 0)
+        {
+            existing->refs++;
+            break;
+        }
+    }
+    if (existing == NULL)
+    {
+        entry->next = acceptor_creds;
+        acceptor_creds = entry;
+    }
+    pthread_mutex_unlock(&acceptor_mutex);
+
+    // Somebody else got there first
+    if (existing != NULL)
+    {
+        acceptor_cred_free(entry);
+        return existing;
+    }
+
+    return entry;
+}
+
+void authenticate_gss_server_invalidate(const char *service)
+{
+    acceptor_cred *unlinked;
+
+    // States still using an entry keep it until they are cleaned
+    pthread_mutex_lock(&acceptor_mutex);
+    unlinked = acceptor_cred_unlink(service, 0, 0);
+    pthread_mutex_unlock(&acceptor_mutex);
+
+    acceptor_cred_release_list(unlinked);
+}
+
+void authenticate_gss_server_set_cred_ttl(int seconds)
+{
+    pthread_mutex_lock(&acceptor_mutex);
+    acceptor_cred_ttl = seconds;
+    pthread_mutex_unlock(&acceptor_mutex);
+}
+
+gss_response *authenticate_gss_server_init(const char *service, int mech, gss_server_state *state)
+{
+    OM_uint32 maj_stat;
+    OM_uint32 min_stat;
     gss_response *response = NULL;
     int ret = AUTH_GSS_COMPLETE;
 
+    KERBEROS_PROBE3(gss_entry, KERBEROS_OP_SERVER_INIT, state, 0);
+
     state->context = GSS_C_NO_CONTEXT;
     state->server_name = GSS_C_NO_NAME;
     state->client_name = GSS_C_NO_NAME;
@@ -354,34 +1772,32 @@ gss_response *authenticate_gss_server_init(const char *service, gss_server_state
     state->username = NULL;
     state->targetname = NULL;
     state->response = NULL;
-
-    // Server name may be empty which means we aren't going to create our own creds
+    state->response_token.value = NULL;
+    state->response_token.length = 0;
+    state->response_format = AUTH_GSS_RESPONSE_BASE64;
+    state->acceptor = NULL;
+    state->established = 0;
+    state->ret_flags = 0;
+    state->expires = 0;
+
+    // Server name may be empty which means we aren't going to create our own
+    // creds, unless they have to be restricted to a mechanism
     size_t service_len = strlen(service);
-    if (service_len != 0)
+    if (service_len != 0 || mech != AUTH_GSS_MECH_DEFAULT)
     {
-        // Import server name first
-        name_token.length = strlen(service);
-        name_token.value = (char *)service;
-
-        maj_stat = gss_import_name(&min_stat, &name_token, GSS_C_NT_HOSTBASED_SERVICE, &state->server_name);
+        // Borrow the name and credentials from the cache
+        acceptor_cred *entry = acceptor_cred_get(service, mech, &maj_stat, &min_stat);
 
-        if (GSS_ERROR(maj_stat))
+        if (entry == NULL)
         {
             response = gss_error(maj_stat, min_stat);
             response->return_code = AUTH_GSS_ERROR;
             goto end;
         }
 
-        // Get credentials
-        maj_stat = gss_acquire_cred(&min_stat, state->server_name, GSS_C_INDEFINITE,
-                                    GSS_C_NO_OID_SET, GSS_C_ACCEPT, &state->server_creds, NULL, NULL);
-
-        if (GSS_ERROR(maj_stat))
-        {
-            response = gss_error(maj_stat, min_stat);
-            response->return_code = AUTH_GSS_ERROR;
-            goto end;
-        }
+        state->acceptor = entry;
+        state->server_name = entry->name;
+        state->server_creds = entry->cred;
     }
 
 end:
@@ -392,6 +1808,7 @@ end:
       response->return_code = ret;
     }
 
+    KERBEROS_PROBE5(gss_return, KERBEROS_OP_SERVER_INIT, state, response->return_code, response->major_status, response->minor_status);
     return response;
 }
 
@@ -401,8 +1818,18 @@ gss_response *authenticate_gss_server_clean(gss_server_state *state)
     gss_response *response = NULL;
     int ret = AUTH_GSS_COMPLETE;
 
+    KERBEROS_PROBE3(gss_entry, KERBEROS_OP_SERVER_CLEAN, state, 0);
+
     if (state->context != GSS_C_NO_CONTEXT)
         gss_delete_sec_context(&min_stat, &state->context, GSS_C_NO_BUFFER);
+    if (state->acceptor != NULL)
+    {
+        // Borrowed, hand them back to the cache
+        acceptor_cred_release((acceptor_cred *)state->acceptor);
+        state->acceptor = NULL;
+        state->server_name = GSS_C_NO_NAME;
+        state->server_creds = GSS_C_NO_CREDENTIAL;
+    }
     if (state->server_name != GSS_C_NO_NAME)
         gss_release_name(&min_stat, &state->server_name);
     if (state->client_name != GSS_C_NO_NAME)
@@ -421,11 +1848,7 @@ gss_response *authenticate_gss_server_clean(gss_server_state *state)
         free(state->targetname);
         state->targetname = NULL;
     }
-    if (state->response != NULL)
-    {
-        free(state->response);
-        state->response = NULL;
-    }
+    clear_response(&state->response, &state->response_token);
 
     if(response == NULL) {
       response = calloc(1, sizeof(gss_response));
@@ -433,10 +1856,11 @@ gss_response *authenticate_gss_server_clean(gss_server_state *state)
       response->return_code = ret;
     }
 
+    KERBEROS_PROBE5(gss_return, KERBEROS_OP_SERVER_CLEAN, state, response->return_code, response->major_status, response->minor_status);
     return response;
 }
 
-gss_response *authenticate_gss_server_step(gss_server_state *state, const char *challenge)
+gss_response *authenticate_gss_server_step(gss_server_state *state, const unsigned char *token, size_t token_len)
 {
     OM_uint32 maj_stat;
     OM_uint32 min_stat;
@@ -444,20 +1868,19 @@ gss_response *authenticate_gss_server_step(gss_server_state *state, const char *
     gss_buffer_desc output_token = GSS_C_EMPTY_BUFFER;
     gss_response *response = NULL;
     int ret = AUTH_GSS_CONTINUE;
+    OM_uint32 ret_flags = 0;
+    OM_uint32 time_rec = 0;
+
+    KERBEROS_PROBE3(gss_entry, KERBEROS_OP_SERVER_STEP, state, token_len);
 
     // Always clear out the old response
-    if (state->response != NULL)
-    {
-        free(state->response);
-        state->response = NULL;
-    }
+    clear_response(&state->response, &state->response_token);
 
     // If there is a challenge (data from the server) we need to give it to GSS
-    if (challenge && *challenge)
+    if (token_len > 0)
     {
-        int len;
-        input_token.value = base64_decode(challenge, &len);
-        input_token.length = len;
+        input_token.value = (void *)token;
+        input_token.length = token_len;
     }
     else
     {
@@ -476,8 +1899,8 @@ gss_response *authenticate_gss_server_step(gss_server_state *state, const char *
                                       &state->client_name,
                                       NULL,
                                       &output_token,
-                                      NULL,
-                                      NULL,
+                                      &ret_flags,
+                                      &time_rec,
                                       &state->client_creds);
 
     if (GSS_ERROR(maj_stat))
@@ -487,11 +1910,17 @@ gss_response *authenticate_gss_server_step(gss_server_state *state, const char *
         goto end;
     }
 
+    if (maj_stat == GSS_S_COMPLETE)
+    {
+        state->established = 1;
+        state->ret_flags = ret_flags;
+        state->expires = context_expiry(time_rec);
+    }
+
     // Grab the server response to send back to the client
     if (output_token.length)
     {
-        state->response = base64_encode((const unsigned char *)output_token.value, output_token.length);;
-        maj_stat = gss_release_buffer(&min_stat, &output_token);
+        set_response(state->response_format, &output_token, &state->response, &state->response_token);
     }
 
     // Get the user name
@@ -506,8 +1935,8 @@ gss_response *authenticate_gss_server_step(gss_server_state *state, const char *
     strncpy(state->username, (char*) output_token.value, output_token.length);
     state->username[output_token.length] = 0;
 
-    // Get the target name if no server creds were supplied
-    if (state->server_creds == GSS_C_NO_CREDENTIAL)
+    // Get the target name if no server name was supplied
+    if (state->server_name == GSS_C_NO_NAME)
     {
         gss_name_t target_name = GSS_C_NO_NAME;
         maj_stat = gss_inquire_context(&min_stat, state->context, NULL, &target_name, NULL, NULL, NULL, NULL, NULL);
@@ -534,8 +1963,6 @@ gss_response *authenticate_gss_server_step(gss_server_state *state, const char *
 end:
     if (output_token.length)
         gss_release_buffer(&min_stat, &output_token);
-    if (input_token.value)
-        free(input_token.value);
 
     if(response == NULL) {
       response = calloc(1, sizeof(gss_response));
@@ -543,6 +1970,7 @@ end:
       response->return_code = ret;
     }
 
+    KERBEROS_PROBE5(gss_return, KERBEROS_OP_SERVER_STEP, state, response->return_code, response->major_status, response->minor_status);
     return response;
 }
 
@@ -593,6 +2021,9 @@ gss_response *gss_error(OM_uint32 err_maj, OM_uint32 err_min) {
   free(buf_maj);
   // Set the message
   response->message = message;
+  // Keep the codes for the error counters
+  response->major_status = err_maj;
+  response->minor_status = err_min;
   // Return the message
   return response;
 }
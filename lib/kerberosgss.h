@@ -19,6 +19,9 @@
 #include <gssapi/gssapi.h>
 #include <gssapi/gssapi_generic.h>
 #include <gssapi/gssapi_krb5.h>
+#include <krb5.h>
+#include <pthread.h>
+#include <time.h>
 
 #define AUTH_GSS_ERROR      -1
 #define AUTH_GSS_COMPLETE    1
@@ -28,17 +31,74 @@
 #define GSS_AUTH_P_INTEGRITY    2
 #define GSS_AUTH_P_PRIVACY      4
 
+#define AUTH_GSS_RESPONSE_BASE64  0
+#define AUTH_GSS_RESPONSE_RAW     1
+
+// Mechanism of a context, the default lets the GSS library pick
+#define AUTH_GSS_MECH_DEFAULT     0
+#define AUTH_GSS_MECH_KRB5        1
+#define AUTH_GSS_MECH_SPNEGO      2
+
 typedef struct {
   int return_code;
   char *message;
+  OM_uint32 major_status;
+  OM_uint32 minor_status;
 } gss_response;
 
+// One generation of initiator credentials. A renewal puts a new one in
+// place, steps borrow a reference so the old one lives until they return.
+typedef struct {
+  gss_cred_id_t    cred;
+  int              refs;
+  // Keytab logins keep their TGT in a MEMORY ccache of their own
+  krb5_context     krb5;
+  krb5_ccache      ccache;
+  // When the tickets were obtained and run out, 0 expires for never
+  time_t           obtained;
+  time_t           expires;
+  // Renewable until, 0 if the TGT is not renewable
+  time_t           renew_till;
+  // Lock file prefix when the ccache is shared with other processes
+  char*            lock_prefix;
+  // Full name of ccache, for lookups through other krb5 contexts
+  char*            ccache_name;
+} gss_cred_handle;
+
+// Initiator credentials acquired once and shared by client states, freed
+// when the last reference goes
+typedef struct {
+  // Current handle, guarded by lock
+  gss_cred_handle* handle;
+  pthread_mutex_t  lock;
+  // Held while a refresh runs
+  pthread_mutex_t  refresh_lock;
+  char*            principal;
+  // Client keytab of a login, NULL otherwise
+  char*            keytab;
+  // Shared ccache of a login and where its lock files go, NULL otherwise
+  char*            shared;
+  char*            lock_dir;
+  // Acquired with a password, which we don't keep around
+  int              password;
+  int              refs;
+} gss_client_cred;
+
 typedef struct {
   gss_ctx_id_t     context;
   gss_name_t       server_name;
+  char*            service;
+  gss_client_cred* cred;
   long int         gss_flags;
+  int              mech;
   char*            username;
   char*            response;
+  gss_buffer_desc  response_token;
+  int              response_format;
+  // Set once the context is established, expires is 0 for never
+  int              established;
+  OM_uint32        ret_flags;
+  time_t           expires;
 } gss_client_state;
 
 typedef struct {
@@ -50,17 +110,67 @@ typedef struct {
   char*            username;
   char*            targetname;
   char*            response;
+  gss_buffer_desc  response_token;
+  int              response_format;
+  void*            acceptor;
+  // Set once the context is established, expires is 0 for never
+  int              established;
+  OM_uint32        ret_flags;
+  time_t           expires;
 } gss_server_state;
 
-gss_response *authenticate_gss_client_init(const char* service, long int gss_flags, gss_client_state* state);
+gss_response *authenticate_gss_client_init(const char* service, long int gss_flags, int mech, gss_client_cred* cred, gss_client_state* state);
 gss_response *authenticate_gss_client_clean(gss_client_state *state);
-gss_response *authenticate_gss_client_step(gss_client_state *state, const char *challenge);
-gss_response *authenticate_gss_client_unwrap(gss_client_state* state, const char* challenge);
-gss_response *authenticate_gss_client_wrap(gss_client_state* state, const char* challenge, const char* user);
+gss_response *authenticate_gss_client_step(gss_client_state *state, const unsigned char *token, size_t token_len);
+// Step only if that needs no KDC: later legs, and first legs whose service
+// ticket is in the ccache. NULL otherwise, state is left alone.
+gss_response *authenticate_gss_client_step_cached(gss_client_state *state, const unsigned char *token, size_t token_len);
+gss_response *authenticate_gss_client_unwrap(gss_client_state* state, const unsigned char* token, size_t token_len);
+gss_response *authenticate_gss_client_wrap(gss_client_state* state, const unsigned char* token, size_t token_len, const char* user);
 
-gss_response *authenticate_gss_server_init(const char* service, gss_server_state* state);
+// With a mech other than the default the acceptor only takes tokens of that
+// mechanism, SPNEGO restricted to negotiating krb5
+gss_response *authenticate_gss_server_init(const char* service, int mech, gss_server_state* state);
 gss_response *authenticate_gss_server_clean(gss_server_state *state);
-gss_response *authenticate_gss_server_step(gss_server_state *state, const char *challenge);
+gss_response *authenticate_gss_server_step(gss_server_state *state, const unsigned char *token, size_t token_len);
+
+// Acquire initiator credentials for principal (NULL for the default one)
+// from the ccache, or from the KDC with password when it is given
+gss_response *authenticate_gss_cred_acquire(const char* principal, const char* password, gss_client_cred** cred);
+// Get a TGT for principal from a client keytab into a private MEMORY ccache,
+// starting from the unexpired tickets of a snapshot file when given one. With
+// shared (e.g. KCM: or KEYRING:persistent:1000) the tickets go to that ccache
+// instead, and the processes using it fetch each ticket once between them
+// under flocks in lock_dir. A shared ccache takes no snapshot.
+gss_response *authenticate_gss_cred_login(const char* principal, const char* keytab, const char* snapshot, const char* shared, const char* lock_dir, gss_client_cred** cred);
+// Write the unexpired tickets of a keytab login to a 0600 snapshot file.
+// Never waits on a refresh. Snapshots not owned by the current user or
+// writable by others are ignored on login.
+gss_response *authenticate_gss_cred_save(gss_client_cred* cred, const char* path);
+// Renew or acquire the credentials again, the new ones are used by the
+// following steps. Password credentials can't be refreshed.
+gss_response *authenticate_gss_cred_refresh(gss_client_cred* cred);
+// Type:residual name of the ccache of a login, to free, NULL for
+// credentials whose ccache is internal to GSS
+char *authenticate_gss_cred_ccache_name(gss_client_cred* cred);
+// Times of the current handle
+void authenticate_gss_cred_times(gss_client_cred* cred, time_t* obtained, time_t* expires);
+void authenticate_gss_cred_retain(gss_client_cred* cred);
+void authenticate_gss_cred_release(gss_client_cred* cred);
+
+// Fetch the service ticket for service into the ccache of cred (NULL for
+// the default one) ahead of the first context
+gss_response *authenticate_gss_client_prefetch(const char* service, gss_client_cred* cred);
+
+// First legs that waited for a concurrent fetch of the same service ticket
+unsigned long authenticate_gss_client_coalesced(void);
+
+// Imported client service names are interned, this empties the cache
+void authenticate_gss_client_clear_names(void);
+
+// Acceptor credentials are cached per service and shared by server states
+void authenticate_gss_server_invalidate(const char *service);
+void authenticate_gss_server_set_cred_ttl(int seconds);
 
 gss_response *gss_error(OM_uint32 err_maj, OM_uint32 err_min);
 #endif
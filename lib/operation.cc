@@ -0,0 +1,106 @@
+#include "operation.h"
+#include "stats.h"
+
+void die(const char *message);
+
+OperationBuffer::OperationBuffer() : data(NULL), length(0), capacity(0) {
+}
+
+OperationBuffer::~OperationBuffer() {
+  free(data);
+}
+
+unsigned char *OperationBuffer::Reserve(size_t size) {
+  if(data == NULL || size > capacity) {
+    // Always keep room for a NUL so strings fit too
+    unsigned char *grown = (unsigned char *)realloc(data, size + 1);
+    if(grown == NULL) die("Memory allocation failed");
+    data = grown;
+    capacity = size;
+  }
+
+  length = 0;
+  return data;
+}
+
+const char *OperationBuffer::CopyString(Handle<String> string) {
+  size_t size = string->Utf8Length();
+  Reserve(size);
+  string->WriteUtf8((char *)data);
+  data[size] = 0;
+  length = size;
+  return (const char *)data;
+}
+
+OperationBatch::OperationBatch(uint32_t count, Handle<Function> callback) : remaining(count) {
+  this->callback = Persistent<Function>::New(callback);
+  this->results = Persistent<Array>::New(Array::New(count));
+}
+
+OperationBatch::~OperationBatch() {
+  callback.Dispose();
+  results.Dispose();
+}
+
+Operation::Operation() : owner(NULL), context(NULL), batch(NULL), batch_index(0), id(0), dispatched(false), pending_prev(NULL), pending_next(NULL), next(NULL) {
+  request.data = this;
+  ResetResult();
+}
+
+Operation::~Operation() {
+}
+
+void Operation::Run() {
+  uint64_t start = uv_hrtime();
+  if(queued_at != 0) Stats::RecordPhase(Type(), PHASE_QUEUE_WAIT, start - queued_at);
+
+  Execute();
+  execute_time = uv_hrtime() - start;
+
+  Stats::RecordPhase(Type(), PHASE_EXECUTE, execute_time);
+  Stats::RecordTokens(token_in, token_out);
+}
+
+bool Operation::RunCached() {
+  uint64_t start = uv_hrtime();
+
+  if(!ExecuteCached()) return false;
+  execute_time = uv_hrtime() - start;
+
+  Stats::RecordPhase(Type(), PHASE_EXECUTE, execute_time);
+  Stats::RecordTokens(token_in, token_out);
+  return true;
+}
+
+Handle<Value> Operation::Map() {
+  HandleScope scope;
+  // Return the return code
+  return scope.Close(Int32::New(return_code));
+}
+
+void Operation::ResetResult() {
+  owner = NULL;
+  context = NULL;
+  batch = NULL;
+  batch_index = 0;
+  error = false;
+  error_message = NULL;
+  error_code = 0;
+  return_code = 0;
+  major_status = 0;
+  minor_status = 0;
+  token_in = 0;
+  token_out = 0;
+  queued_at = 0;
+  execute_time = 0;
+  id = 0;
+  dispatched = false;
+  pending_prev = NULL;
+  pending_next = NULL;
+}
+
+void Operation::Fail(int code, const char *message) {
+  error = true;
+  error_code = code;
+  error_message = (char *)message;
+}
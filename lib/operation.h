@@ -0,0 +1,243 @@
+#ifndef OPERATION_H_
+#define OPERATION_H_
+
+#include <node.h>
+#include <v8.h>
+#include <stdlib.h>
+#include <gssapi/gssapi.h>
+
+extern "C" {
+  #include "probes.h"
+}
+
+using namespace node;
+using namespace v8;
+
+class Kerberos;
+class KerberosContext;
+
+// Operation types, the index of their stats
+enum OperationType {
+  OPERATION_CLIENT_INIT = KERBEROS_OP_CLIENT_INIT,
+  OPERATION_CLIENT_STEP = KERBEROS_OP_CLIENT_STEP,
+  OPERATION_CLIENT_UNWRAP = KERBEROS_OP_CLIENT_UNWRAP,
+  OPERATION_CLIENT_WRAP = KERBEROS_OP_CLIENT_WRAP,
+  OPERATION_CLIENT_CLEAN = KERBEROS_OP_CLIENT_CLEAN,
+  OPERATION_SERVER_INIT = KERBEROS_OP_SERVER_INIT,
+  OPERATION_SERVER_STEP = KERBEROS_OP_SERVER_STEP,
+  OPERATION_SERVER_CLEAN = KERBEROS_OP_SERVER_CLEAN,
+  OPERATION_CREDENTIAL_ACQUIRE = KERBEROS_OP_CRED_ACQUIRE,
+  OPERATION_CREDENTIAL_REFRESH = KERBEROS_OP_CRED_REFRESH,
+  OPERATION_CLIENT_PREFETCH = KERBEROS_OP_CLIENT_PREFETCH,
+  OPERATION_TYPES
+};
+
+// Error code of operations cancelled before they ran
+#define OPERATION_CANCELLED -2
+// Error code of operations refused because too many were queued
+#define OPERATION_OVERLOADED -3
+
+// Moving average of the execute time of one operation type, only updated on
+// the loop thread
+class ExecuteEstimate {
+  public:
+    ExecuteEstimate() : average(0), samples(0) {}
+
+    // Fold in one execute time in nanoseconds, weight 1/8
+    void Add(uint64_t sample) {
+      if(samples++ == 0) {
+        average = sample;
+      } else {
+        average = average + ((int64_t)sample - (int64_t)average) / 8;
+      }
+    }
+
+    uint64_t average;
+    uint32_t samples;
+};
+
+// Operations submitted together by one of the *Many calls, the callback
+// fires once with all results when the last one completes
+class OperationBatch {
+  public:
+    OperationBatch(uint32_t count, Handle<Function> callback);
+    ~OperationBatch();
+
+    // Callback
+    Persistent<Function> callback;
+    // Result or Error per operation, in submission order
+    Persistent<Array> results;
+    // Operations still to complete
+    uint32_t remaining;
+};
+
+// Byte buffer that only ever grows, so a recycled operation stops allocating
+// once it has seen its largest argument
+class OperationBuffer {
+  public:
+    OperationBuffer();
+    ~OperationBuffer();
+
+    // Make room for size bytes and empty the buffer
+    unsigned char *Reserve(size_t size);
+    // Copy a v8 string in as a NUL terminated utf8 c-string
+    const char *CopyString(Handle<String> string);
+
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// One asynchronous GSS call. The libuv request, the callback, the arguments
+// (in subclasses) and the result all live in this one object.
+class Operation {
+  public:
+    Operation();
+    virtual ~Operation();
+
+    // Runs on a thread pool worker, or inline for the sync and adaptive calls
+    virtual void Execute() = 0;
+    // Execute and record how long it took
+    void Run();
+    // Execute right away if that needs no KDC, false leaves the operation
+    // for the pool. Runs on the loop thread.
+    virtual bool ExecuteCached() { return false; }
+    // ExecuteCached and record how long it took
+    bool RunCached();
+    // Execute time estimate of the operation type
+    virtual ExecuteEstimate *Estimate() = 0;
+    // Type of the operation
+    virtual OperationType Type() = 0;
+    // Turns the result into the callback value, runs on the loop thread
+    virtual Handle<Value> Map();
+    // Never talks to the KDC, so adaptive dispatch may run it inline
+    virtual bool Adaptive() { return false; }
+    // Hands the operation back to its pool
+    virtual void Release() = 0;
+
+    // Clear the result so the object can be reused
+    void ResetResult();
+    // Fail the operation with a code of our own instead of running it
+    void Fail(int code, const char *message);
+
+    // libuv's request struct.
+    uv_work_t request;
+    // Callback
+    Persistent<Function> callback;
+    // Kerberos instance whose pool runs the operation
+    Kerberos *owner;
+    // Context the operation runs against, NULL for the init calls
+    KerberosContext *context;
+    // Batch the operation is part of, NULL when it has its own callback
+    OperationBatch *batch;
+    // Slot of the result in the batch
+    uint32_t batch_index;
+    // Did we raise an error
+    bool error;
+    // The error message
+    char *error_message;
+    // Error code if not message
+    int error_code;
+    // Any return code
+    int return_code;
+    // GSS status of a failed call
+    OM_uint32 major_status;
+    OM_uint32 minor_status;
+    // Token bytes passed in and handed back
+    size_t token_in;
+    size_t token_out;
+    // When it was queued, 0 for the sync calls
+    uint64_t queued_at;
+    // Execute time in nanoseconds
+    uint64_t execute_time;
+    // Id handed to js for cancel
+    uint32_t id;
+    // Was it submitted to the pool, counted against the in flight cap
+    bool dispatched;
+    // Links in the owner's list of pending operations
+    Operation *pending_prev;
+    Operation *pending_next;
+    // Link used by the free list and the context and thread pool queues
+    Operation *next;
+};
+
+// Free list of idle operations of one type. Operations are only acquired and
+// released on the loop thread so no locking is needed.
+template<typename T>
+class OperationPool {
+  public:
+    // Idle operations kept around after a burst, anything above is deleted
+    static const size_t kMaxIdle = 256;
+
+    static T *Acquire() {
+      T *operation = free_list;
+
+      if(operation != NULL) {
+        free_list = static_cast<T *>(operation->next);
+        operation->next = NULL;
+        idle--;
+      } else {
+        operation = new T();
+        allocated++;
+      }
+
+      return operation;
+    }
+
+    static void Release(T *operation) {
+      if(idle >= kMaxIdle) {
+        allocated--;
+        delete operation;
+        return;
+      }
+
+      operation->next = free_list;
+      free_list = operation;
+      idle++;
+    }
+
+    // Operations alive, busy or idle
+    static size_t allocated;
+    // Operations waiting in the free list
+    static size_t idle;
+
+  private:
+    static T *free_list;
+};
+
+template<typename T> T *OperationPool<T>::free_list = NULL;
+template<typename T> size_t OperationPool<T>::allocated = 0;
+template<typename T> size_t OperationPool<T>::idle = 0;
+
+// Base for concrete operations, wires Release to the pool of the subclass
+template<typename T>
+class PooledOperation : public Operation {
+  public:
+    static T *Acquire() {
+      return OperationPool<T>::Acquire();
+    }
+
+    virtual void Release() {
+      T *self = static_cast<T *>(this);
+      self->Reset();
+      ResetResult();
+      OperationPool<T>::Release(self);
+    }
+
+    virtual ExecuteEstimate *Estimate() {
+      return &estimate;
+    }
+
+    virtual OperationType Type() {
+      return T::kType;
+    }
+
+    // Drop per call arguments, buffers keep their capacity
+    void Reset() {}
+
+    static ExecuteEstimate estimate;
+};
+
+template<typename T> ExecuteEstimate PooledOperation<T>::estimate;
+
+#endif  // OPERATION_H_
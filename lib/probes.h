@@ -0,0 +1,44 @@
+#ifndef KERBEROS_PROBES_H
+#define KERBEROS_PROBES_H
+
+// Static tracepoints for systemtap, bpftrace and friends, provider
+// "kerberos". Each one is a single nop in the instruction stream plus an
+// ELF note until a tracer attaches. Without <sys/sdt.h> they compile away.
+//
+//  gss_entry   (op, state, token_len)
+//  gss_return  (op, state, return_code, major_status, minor_status)
+//  queue       (op, id, context)
+//  dispatch    (op, id, context)
+//  complete    (op, id, context, error_code, execute_ns)
+//
+// e.g. bpftrace -e 'usdt:./build/Release/kerberos.node:kerberos:gss_return { @[arg0, arg3] = count(); }'
+
+// Operation types passed as op, same numbering as OperationType
+#define KERBEROS_OP_CLIENT_INIT    0
+#define KERBEROS_OP_CLIENT_STEP    1
+#define KERBEROS_OP_CLIENT_UNWRAP  2
+#define KERBEROS_OP_CLIENT_WRAP    3
+#define KERBEROS_OP_CLIENT_CLEAN   4
+#define KERBEROS_OP_SERVER_INIT    5
+#define KERBEROS_OP_SERVER_STEP    6
+#define KERBEROS_OP_SERVER_CLEAN   7
+#define KERBEROS_OP_CRED_ACQUIRE   8
+#define KERBEROS_OP_CRED_REFRESH   9
+#define KERBEROS_OP_CLIENT_PREFETCH 10
+
+#if defined(__linux__) && defined(__has_include) && !defined(KERBEROS_NO_PROBES)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define KERBEROS_HAVE_PROBES 1
+# endif
+#endif
+
+#ifdef KERBEROS_HAVE_PROBES
+# define KERBEROS_PROBE3(name, a, b, c) DTRACE_PROBE3(kerberos, name, a, b, c)
+# define KERBEROS_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(kerberos, name, a, b, c, d, e)
+#else
+# define KERBEROS_PROBE3(name, a, b, c) do {} while(0)
+# define KERBEROS_PROBE5(name, a, b, c, d, e) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,199 @@
+#include "stats.h"
+
+extern "C" {
+  #include "kerberosgss.h"
+}
+
+// GSS routine errors are numbered 1 to 18, 0 counts our own errors
+#define ROUTINE_ERRORS 19
+
+static const char *phase_names[PHASES] = {
+  "queueWait", "execute", "callback"
+};
+
+static const char *type_names[OPERATION_TYPES] = {
+  "clientInit", "clientStep", "clientUnwrap", "clientWrap", "clientClean",
+  "serverInit", "serverStep", "serverClean", "credentialAcquire",
+  "credentialRefresh", "clientPrefetch"
+};
+
+static const char *routine_error_names[ROUTINE_ERRORS] = {
+  "OTHER", "GSS_S_BAD_MECH", "GSS_S_BAD_NAME", "GSS_S_BAD_NAMETYPE",
+  "GSS_S_BAD_BINDINGS", "GSS_S_BAD_STATUS", "GSS_S_BAD_SIG", "GSS_S_NO_CRED",
+  "GSS_S_NO_CONTEXT", "GSS_S_DEFECTIVE_TOKEN", "GSS_S_DEFECTIVE_CREDENTIAL",
+  "GSS_S_CREDENTIALS_EXPIRED", "GSS_S_CONTEXT_EXPIRED", "GSS_S_FAILURE",
+  "GSS_S_BAD_QOP", "GSS_S_UNAUTHORIZED", "GSS_S_UNAVAILABLE",
+  "GSS_S_DUPLICATE_ELEMENT", "GSS_S_NAME_NOT_MN"
+};
+
+// Histograms per operation type and phase
+static Histogram histograms[OPERATION_TYPES][PHASES];
+// Failed calls by GSS routine error
+static uint64_t errors[ROUTINE_ERRORS];
+// Operations we failed ourselves
+static uint64_t cancelled;
+static uint64_t overloaded;
+// Operations run on the loop thread instead of the pool
+static uint64_t inlined;
+// KerberosContext objects alive
+static int64_t contexts;
+// Token bytes in and out of the GSS calls
+static uint64_t token_bytes_in;
+static uint64_t token_bytes_out;
+
+// Plain loads are fine for the snapshot, the counters only grow and a read
+// racing an add sees either value
+#define ATOMIC_ADD(target, value) __sync_fetch_and_add(&(target), (value))
+#define ATOMIC_READ(target) (*(volatile __typeof__(target) *)&(target))
+
+int Histogram::Index(uint64_t value) {
+  // Small values get a bucket each
+  if(value < HISTOGRAM_SUB_BUCKETS) return (int)value;
+  if(value >= (1ULL << HISTOGRAM_MAX_BITS)) value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+
+  // The top bit picks the power of two, the bits below it the sub bucket
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) + (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+uint64_t Histogram::Lower(int index) {
+  if(index < HISTOGRAM_SUB_BUCKETS) return index;
+
+  int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+  return (uint64_t)(HISTOGRAM_SUB_BUCKETS + (index & (HISTOGRAM_SUB_BUCKETS - 1))) << shift;
+}
+
+void Histogram::Record(uint64_t value) {
+  ATOMIC_ADD(counts[Index(value)], 1);
+  ATOMIC_ADD(count, 1);
+  ATOMIC_ADD(sum, value);
+
+  // Raise the max unless someone beat us to a larger one
+  uint64_t current = ATOMIC_READ(max);
+  while(value > current) {
+    uint64_t seen = __sync_val_compare_and_swap(&max, current, value);
+    if(seen == current) break;
+    current = seen;
+  }
+}
+
+void Stats::RecordPhase(OperationType type, OperationPhase phase, uint64_t duration) {
+  histograms[type][phase].Record(duration);
+}
+
+void Stats::RecordError(Operation *operation) {
+  if(operation->error_code == OPERATION_CANCELLED) {
+    ATOMIC_ADD(cancelled, 1);
+  } else if(operation->error_code == OPERATION_OVERLOADED) {
+    ATOMIC_ADD(overloaded, 1);
+  } else {
+    OM_uint32 routine = GSS_ROUTINE_ERROR(operation->major_status) >> GSS_C_ROUTINE_ERROR_OFFSET;
+    ATOMIC_ADD(errors[routine < ROUTINE_ERRORS ? routine : 0], 1);
+  }
+}
+
+void Stats::RecordInline() {
+  ATOMIC_ADD(inlined, 1);
+}
+
+void Stats::RecordTokens(size_t in, size_t out) {
+  if(in > 0) ATOMIC_ADD(token_bytes_in, in);
+  if(out > 0) ATOMIC_ADD(token_bytes_out, out);
+}
+
+void Stats::ContextCreated() {
+  ATOMIC_ADD(contexts, 1);
+}
+
+void Stats::ContextDestroyed() {
+  ATOMIC_ADD(contexts, -1);
+}
+
+void Stats::Initialize(Handle<Object> target) {
+  // Grab the scope of the call from Node
+  HandleScope scope;
+  // Set the function
+  NODE_SET_METHOD(target, "stats", Snapshot);
+}
+
+Handle<Value> Stats::HistogramSnapshot(Histogram *histogram) {
+  HandleScope scope;
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total = 0;
+
+  // Copy the buckets first so the percentiles agree with each other
+  for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    counts[i] = ATOMIC_READ(histogram->counts[i]);
+    total += counts[i];
+  }
+
+  Local<Object> result = Object::New();
+  uint64_t sum = ATOMIC_READ(histogram->sum);
+  result->Set(String::NewSymbol("count"), Number::New((double)total));
+  result->Set(String::NewSymbol("mean"), Number::New(total > 0 ? (double)sum / total : 0));
+  result->Set(String::NewSymbol("max"), Number::New((double)ATOMIC_READ(histogram->max)));
+
+  // Lower bound of the bucket holding each percentile
+  static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  static const char *names[] = { "p50", "p90", "p99", "p999" };
+
+  for(size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+    uint64_t rank = (uint64_t)(percentiles[p] * total);
+    uint64_t seen = 0;
+    uint64_t value = 0;
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS && total > 0; i++) {
+      seen += counts[i];
+      if(seen > rank) {
+        value = Histogram::Lower(i);
+        break;
+      }
+    }
+
+    result->Set(String::NewSymbol(names[p]), Number::New((double)value));
+  }
+
+  return scope.Close(result);
+}
+
+// Snapshot of all counters, durations are in nanoseconds
+Handle<Value> Stats::Snapshot(const Arguments &args) {
+  HandleScope scope;
+  Local<Object> result = Object::New();
+
+  // Timings per operation type, skipping types never used
+  Local<Object> operations = Object::New();
+  for(int type = 0; type < OPERATION_TYPES; type++) {
+    if(ATOMIC_READ(histograms[type][PHASE_EXECUTE].count) == 0
+      && ATOMIC_READ(histograms[type][PHASE_CALLBACK].count) == 0) continue;
+
+    Local<Object> phases = Object::New();
+    for(int phase = 0; phase < PHASES; phase++) {
+      phases->Set(String::NewSymbol(phase_names[phase]), HistogramSnapshot(&histograms[type][phase]));
+    }
+
+    operations->Set(String::NewSymbol(type_names[type]), phases);
+  }
+  result->Set(String::NewSymbol("operations"), operations);
+
+  // Errors by GSS routine error
+  Local<Object> error_counts = Object::New();
+  for(int i = 0; i < ROUTINE_ERRORS; i++) {
+    uint64_t count = ATOMIC_READ(errors[i]);
+    if(count > 0) error_counts->Set(String::NewSymbol(routine_error_names[i]), Number::New((double)count));
+  }
+  result->Set(String::NewSymbol("errors"), error_counts);
+
+  result->Set(String::NewSymbol("cancelled"), Number::New((double)ATOMIC_READ(cancelled)));
+  result->Set(String::NewSymbol("overloaded"), Number::New((double)ATOMIC_READ(overloaded)));
+  result->Set(String::NewSymbol("inline"), Number::New((double)ATOMIC_READ(inlined)));
+  result->Set(String::NewSymbol("contexts"), Number::New((double)ATOMIC_READ(contexts)));
+  result->Set(String::NewSymbol("coalescedTicketFetches"), Number::New((double)authenticate_gss_client_coalesced()));
+
+  Local<Object> tokens = Object::New();
+  tokens->Set(String::NewSymbol("in"), Number::New((double)ATOMIC_READ(token_bytes_in)));
+  tokens->Set(String::NewSymbol("out"), Number::New((double)ATOMIC_READ(token_bytes_out)));
+  result->Set(String::NewSymbol("tokenBytes"), tokens);
+
+  return scope.Close(result);
+}
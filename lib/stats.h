@@ -0,0 +1,62 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <node.h>
+#include <v8.h>
+#include "operation.h"
+
+using namespace node;
+using namespace v8;
+
+// Sub buckets per power of two, 16 keeps the error of a bucket under 7%
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+// Durations are clamped to 2^40ns, about 18 minutes
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+// Phases timed per operation type
+enum OperationPhase {
+  PHASE_QUEUE_WAIT,
+  PHASE_EXECUTE,
+  PHASE_CALLBACK,
+  PHASES
+};
+
+// Log-linear histogram of nanosecond durations. Recording is a couple of
+// atomic adds, so workers and the loop thread write without a lock and
+// readers take a snapshot while it keeps counting.
+class Histogram {
+  public:
+    void Record(uint64_t value);
+
+    // Bucket a value falls in and the smallest value of a bucket
+    static int Index(uint64_t value);
+    static uint64_t Lower(int index);
+
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+// Process wide counters, shared by all Kerberos instances
+class Stats {
+  public:
+    // Exposes the snapshot function to js
+    static void Initialize(Handle<Object> target);
+
+    // Recorders, safe from any thread
+    static void RecordPhase(OperationType type, OperationPhase phase, uint64_t duration);
+    static void RecordError(Operation *operation);
+    static void RecordTokens(size_t in, size_t out);
+    static void RecordInline();
+    static void ContextCreated();
+    static void ContextDestroyed();
+
+  private:
+    static Handle<Value> Snapshot(const Arguments &args);
+    static Handle<Value> HistogramSnapshot(Histogram *histogram);
+};
+
+#endif  // STATS_H_
@@ -0,0 +1,239 @@
+#ifdef __linux__
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+# include <sched.h>
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "thread_pool.h"
+
+void die(const char *message);
+
+void ThreadPool::DefaultOptions(ThreadPoolOptions *options) {
+  // Same width as the libuv pool we used to share
+  options->size = 4;
+  strcpy(options->name, "kerberos");
+  options->cpu_count = 0;
+}
+
+ThreadPool::ThreadPool(uv_loop_t *loop, const ThreadPoolOptions *options, uv_work_cb work, uv_after_work_cb after) {
+  this->options = *options;
+  this->work = work;
+  this->after = after;
+  this->pending = 0;
+  this->started = 0;
+  this->work_head = NULL;
+  this->work_tail = NULL;
+  this->done_head = NULL;
+  this->done_tail = NULL;
+  this->stopping = false;
+
+  if(uv_mutex_init(&mutex) != 0) die("Failed to create thread pool mutex");
+  if(uv_cond_init(&cond) != 0) die("Failed to create thread pool condition");
+
+  // Completions wake the loop, but an idle pool must not keep it alive
+  uv_async_init(loop, &async, (uv_async_cb)ThreadPool::Completed);
+  async.data = this;
+  uv_unref((uv_handle_t *)&async);
+
+  threads = (uv_thread_t *)calloc(this->options.size, sizeof(uv_thread_t));
+  if(threads == NULL) die("Memory allocation failed");
+
+  for(int i = 0; i < this->options.size; i++) {
+    if(uv_thread_create(&threads[i], ThreadPool::Work, this) != 0) die("Failed to start thread pool worker");
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  uv_cond_destroy(&cond);
+  uv_mutex_destroy(&mutex);
+  free(threads);
+}
+
+void ThreadPool::Destroy() {
+  uv_mutex_lock(&mutex);
+  stopping = true;
+  uv_cond_broadcast(&cond);
+  uv_mutex_unlock(&mutex);
+
+  for(int i = 0; i < options.size; i++) {
+    uv_thread_join(&threads[i]);
+  }
+
+  // The handle has to outlive the close
+  uv_close((uv_handle_t *)&async, ThreadPool::Closed);
+}
+
+void ThreadPool::Closed(uv_handle_t *handle) {
+  delete static_cast<ThreadPool *>(handle->data);
+}
+
+void ThreadPool::Submit(Operation *operations) {
+  Operation *last = operations;
+  int count = 1;
+
+  while(last->next != NULL) {
+    last = last->next;
+    count++;
+  }
+
+  // Keep the loop running until the operations have called back
+  if(pending == 0) uv_ref((uv_handle_t *)&async);
+  pending += count;
+
+  uv_mutex_lock(&mutex);
+  if(work_tail == NULL) {
+    work_head = operations;
+  } else {
+    work_tail->next = operations;
+  }
+  work_tail = last;
+
+  // Wake as many workers as there is work for
+  if(count == 1) {
+    uv_cond_signal(&cond);
+  } else {
+    uv_cond_broadcast(&cond);
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+void ThreadPool::Deliver(Operation *operation) {
+  if(pending++ == 0) uv_ref((uv_handle_t *)&async);
+
+  operation->next = NULL;
+
+  uv_mutex_lock(&mutex);
+  if(done_tail == NULL) {
+    done_head = operation;
+  } else {
+    done_tail->next = operation;
+  }
+  done_tail = operation;
+  uv_mutex_unlock(&mutex);
+
+  uv_async_send(&async);
+}
+
+bool ThreadPool::Cancel(Operation *operation) {
+  Operation *previous = NULL;
+  bool found = false;
+
+  uv_mutex_lock(&mutex);
+  for(Operation *current = work_head; current != NULL; current = current->next) {
+    if(current != operation) {
+      previous = current;
+      continue;
+    }
+
+    // Unlink it from the work list
+    if(previous == NULL) {
+      work_head = current->next;
+    } else {
+      previous->next = current->next;
+    }
+    if(work_tail == current) work_tail = previous;
+
+    // And append it to the done list, it stays counted as pending
+    current->next = NULL;
+    if(done_tail == NULL) {
+      done_head = current;
+    } else {
+      done_tail->next = current;
+    }
+    done_tail = current;
+    found = true;
+    break;
+  }
+  uv_mutex_unlock(&mutex);
+
+  if(found) uv_async_send(&async);
+  return found;
+}
+
+void ThreadPool::Work(void *arg) {
+  ThreadPool *pool = static_cast<ThreadPool *>(arg);
+  int index;
+
+  uv_mutex_lock(&pool->mutex);
+  index = pool->started++;
+  uv_mutex_unlock(&pool->mutex);
+
+  // Name the thread so it shows up in top, perf and gdb
+  char name[16];
+  snprintf(name, sizeof(name), "%s-%d", pool->options.name, index);
+#if defined(__APPLE__)
+  pthread_setname_np(name);
+#elif defined(__linux__)
+  pthread_setname_np(pthread_self(), name);
+#endif
+
+#ifdef __linux__
+  // Pin the worker if cpus were given
+  if(pool->options.cpu_count > 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(pool->options.cpus[index % pool->options.cpu_count], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+
+  uv_mutex_lock(&pool->mutex);
+
+  while(true) {
+    while(pool->work_head == NULL && !pool->stopping) {
+      uv_cond_wait(&pool->cond, &pool->mutex);
+    }
+
+    if(pool->stopping) break;
+
+    // Take the oldest operation
+    Operation *operation = pool->work_head;
+    pool->work_head = operation->next;
+    if(pool->work_head == NULL) pool->work_tail = NULL;
+    uv_mutex_unlock(&pool->mutex);
+
+    pool->work(&operation->request);
+
+    // Hand it to the loop
+    uv_mutex_lock(&pool->mutex);
+    operation->next = NULL;
+    if(pool->done_tail == NULL) {
+      pool->done_head = operation;
+    } else {
+      pool->done_tail->next = operation;
+    }
+    pool->done_tail = operation;
+    uv_mutex_unlock(&pool->mutex);
+
+    uv_async_send(&pool->async);
+
+    uv_mutex_lock(&pool->mutex);
+  }
+
+  uv_mutex_unlock(&pool->mutex);
+}
+
+void ThreadPool::Completed(uv_async_t *handle, int status) {
+  ThreadPool *pool = static_cast<ThreadPool *>(handle->data);
+
+  // Sends coalesce, so take everything that is done
+  uv_mutex_lock(&pool->mutex);
+  Operation *operation = pool->done_head;
+  pool->done_head = NULL;
+  pool->done_tail = NULL;
+  uv_mutex_unlock(&pool->mutex);
+
+  while(operation != NULL) {
+    // after may recycle the operation or queue it elsewhere
+    Operation *next = operation->next;
+    operation->next = NULL;
+    pool->pending--;
+    pool->after(&operation->request, 0);
+    operation = next;
+  }
+
+  if(pool->pending == 0) uv_unref((uv_handle_t *)&pool->async);
+}
@@ -0,0 +1,74 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <node.h>
+#include "operation.h"
+
+// Pool settings, taken from the options given to new Kerberos({...})
+typedef struct ThreadPoolOptions {
+  // Number of worker threads
+  int size;
+  // Thread name prefix, workers are called <name>-<n>
+  char name[16];
+  // Cpus the workers are pinned to round robin, none means no pinning
+  int cpus[64];
+  int cpu_count;
+} ThreadPoolOptions;
+
+// Worker threads of our own for the blocking GSS calls, so a slow KDC only
+// ever stalls these and not the libuv threadpool shared with fs, dns and
+// zlib. Completions are handed back to the loop through a uv_async_t.
+class ThreadPool {
+  public:
+    ThreadPool(uv_loop_t *loop, const ThreadPoolOptions *options, uv_work_cb work, uv_after_work_cb after);
+
+    // Queue a list of operations linked through next, called on the loop
+    // thread. work runs on a pool thread and after back on the loop, both
+    // with &operation->request. A list is handed over under one lock.
+    void Submit(Operation *operations);
+
+    // Hand an operation that already ran inline to after on a later loop
+    // iteration, so callbacks never fire before the call returns
+    void Deliver(Operation *operation);
+
+    // Move an operation no worker has picked up yet straight to the done
+    // list, so after sees it without it having run. False if it is gone.
+    bool Cancel(Operation *operation);
+
+    // Stop the workers and free the pool once libuv is done with it
+    void Destroy();
+
+    // Fill in the defaults
+    static void DefaultOptions(ThreadPoolOptions *options);
+
+    // Submitted and not yet completed, loop thread only
+    int pending;
+
+  private:
+    ~ThreadPool();
+
+    static void Work(void *arg);
+    static void Completed(uv_async_t *handle, int status);
+    static void Closed(uv_handle_t *handle);
+
+    ThreadPoolOptions options;
+    uv_work_cb work;
+    uv_after_work_cb after;
+
+    uv_thread_t *threads;
+    int started;
+    uv_async_t async;
+
+    // Guards everything below
+    uv_mutex_t mutex;
+    uv_cond_t cond;
+    // Waiting to run, linked through Operation::next
+    Operation *work_head;
+    Operation *work_tail;
+    // Done and waiting for the loop
+    Operation *done_head;
+    Operation *done_tail;
+    bool stopping;
+};
+
+#endif  // THREAD_POOL_H_
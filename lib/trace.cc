@@ -0,0 +1,213 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+void die(const char *message);
+
+// Slow fetches, oldest overwritten first
+static TraceRecord ring[TRACE_RING_SIZE];
+static uint32_t ring_next = 0;
+static uint32_t ring_count = 0;
+static uv_mutex_t ring_mutex;
+
+void Trace::Initialize(Handle<Object> target) {
+  // Grab the scope of the call from Node
+  HandleScope scope;
+  if(uv_mutex_init(&ring_mutex) != 0) die("Failed to create trace mutex");
+  // Set the function
+  NODE_SET_METHOD(target, "traces", Outliers);
+}
+
+#ifdef KERBEROS_HAVE_TRACE
+// State of one traced fetch
+typedef struct Tracer {
+  TraceRecord *record;
+  // When the request the next answer belongs to went out
+  uint64_t sent_at;
+  // Did we talk UDP yet
+  bool sent_udp;
+} Tracer;
+
+// Does message start with prefix
+static bool StartsWith(const char *message, const char *prefix) {
+  return strncmp(message, prefix, strlen(prefix)) == 0;
+}
+
+// Copy the text after marker up to the first of stop or the end
+static void CopyAfter(const char *message, const char *marker, const char *stop, char *out, size_t size) {
+  const char *start = strstr(message, marker);
+  if(start == NULL) return;
+  start += strlen(marker);
+
+  size_t length = strcspn(start, stop);
+  if(length >= size) length = size - 1;
+  memcpy(out, start, length);
+  out[length] = 0;
+}
+
+void Trace::Callback(krb5_context context, const krb5_trace_info *info, void *data) {
+  Tracer *tracer = (Tracer *)data;
+  TraceRecord *record = tracer->record;
+
+  // Called without info when the callback is dropped
+  if(info == NULL || info->message == NULL) return;
+  const char *message = info->message;
+
+  if(StartsWith(message, "Sending initial UDP request to ")) {
+    tracer->sent_at = uv_hrtime();
+    tracer->sent_udp = true;
+  } else if(StartsWith(message, "Sending retry UDP request to ")) {
+    tracer->sent_at = uv_hrtime();
+    record->retries++;
+  } else if(StartsWith(message, "Initiating TCP connection to ")) {
+    if(tracer->sent_udp) record->tcp_fallback = true;
+  } else if(StartsWith(message, "Sending TCP request to ")) {
+    tracer->sent_at = uv_hrtime();
+  } else if(StartsWith(message, "Received answer (")) {
+    // A round trip to the KDC named after from
+    uint64_t rtt = uv_hrtime() - tracer->sent_at;
+    record->requests++;
+    record->rtt_total += rtt;
+    if(rtt > record->rtt_max) record->rtt_max = rtt;
+    CopyAfter(message, " from ", "\n", record->kdc, sizeof(record->kdc));
+  } else if(StartsWith(message, "Retrieving ")) {
+    // Credential cache lookup, result 0 means it was there
+    const char *result = strstr(message, "with result: ");
+    if(result != NULL && atoi(result + strlen("with result: ")) == 0) {
+      record->ccache_hits++;
+    } else {
+      record->ccache_misses++;
+    }
+  } else if(StartsWith(message, "TGS reply is for ")) {
+    // The session key prints as enctype/key prefix
+    CopyAfter(message, " with session key ", "/", record->enctype, sizeof(record->enctype));
+  } else if(strstr(message, "ollowing referral") != NULL) {
+    record->referrals++;
+  }
+}
+
+void Trace::Fetch(const char *service, const char *ccache_name, TraceRecord *record) {
+  krb5_context context = NULL;
+  krb5_ccache ccache = NULL;
+  krb5_creds request;
+  krb5_creds *creds = NULL;
+  Tracer tracer;
+  struct timeval now;
+  char name[256];
+  krb5_error_code code;
+
+  memset(record, 0, sizeof(TraceRecord));
+  memset(&request, 0, sizeof(request));
+  snprintf(record->service, sizeof(record->service), "%s", service);
+  gettimeofday(&now, NULL);
+  record->timestamp = now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+
+  tracer.record = record;
+  tracer.sent_at = 0;
+  tracer.sent_udp = false;
+
+  uint64_t start = uv_hrtime();
+
+  // A context of our own so only this fetch is traced
+  code = krb5_init_context(&context);
+  if(code != 0) goto end;
+  krb5_set_trace_callback(context, Trace::Callback, &tracer);
+
+  // The ccache the GSS step will look in
+  if(ccache_name != NULL) {
+    code = krb5_cc_resolve(context, ccache_name, &ccache);
+  } else {
+    code = krb5_cc_default(context, &ccache);
+  }
+  if(code != 0) goto end;
+  code = krb5_cc_get_principal(context, ccache, &request.client);
+  if(code != 0) goto end;
+
+  // Same service@host form the GSS name import takes
+  snprintf(name, sizeof(name), "%s", service);
+  {
+    char *host = strchr(name, '@');
+    if(host != NULL) *host++ = 0;
+    code = krb5_sname_to_principal(context, host, name, KRB5_NT_SRV_HST, &request.server);
+  }
+  if(code != 0) goto end;
+
+  code = krb5_get_credentials(context, 0, ccache, &request, &creds);
+  if(code != 0) goto end;
+
+  // Cache hits never see a TGS reply, take the enctype from the ticket
+  if(record->enctype[0] == 0) {
+    krb5_enctype_to_name(creds->keyblock.enctype, 0, record->enctype, sizeof(record->enctype));
+  }
+
+end:
+  record->error = code;
+  record->duration = uv_hrtime() - start;
+
+  if(creds != NULL) krb5_free_creds(context, creds);
+  if(request.server != NULL) krb5_free_principal(context, request.server);
+  if(request.client != NULL) krb5_free_principal(context, request.client);
+  if(ccache != NULL) krb5_cc_close(context, ccache);
+  if(context != NULL) krb5_free_context(context);
+}
+
+#endif
+
+void Trace::Retain(const TraceRecord *record, uint64_t threshold) {
+  if(record->duration < threshold) return;
+
+  uv_mutex_lock(&ring_mutex);
+  ring[ring_next] = *record;
+  ring_next = (ring_next + 1) % TRACE_RING_SIZE;
+  if(ring_count < TRACE_RING_SIZE) ring_count++;
+  uv_mutex_unlock(&ring_mutex);
+}
+
+Handle<Value> Trace::ToObject(const TraceRecord *record) {
+  HandleScope scope;
+  Local<Object> result = Object::New();
+
+  result->Set(String::NewSymbol("contextId"), Uint32::New(record->context_id));
+  result->Set(String::NewSymbol("service"), String::New(record->service));
+  result->Set(String::NewSymbol("timestamp"), Number::New(record->timestamp));
+  result->Set(String::NewSymbol("duration"), Number::New(record->duration / 1e6));
+  result->Set(String::NewSymbol("kdc"), record->kdc[0] ? Handle<Value>(String::New(record->kdc)) : Handle<Value>(Null()));
+  result->Set(String::NewSymbol("requests"), Uint32::New(record->requests));
+  result->Set(String::NewSymbol("rttTotal"), Number::New(record->rtt_total / 1e6));
+  result->Set(String::NewSymbol("rttMax"), Number::New(record->rtt_max / 1e6));
+  result->Set(String::NewSymbol("retries"), Uint32::New(record->retries));
+  result->Set(String::NewSymbol("tcpFallback"), Boolean::New(record->tcp_fallback));
+  result->Set(String::NewSymbol("referrals"), Uint32::New(record->referrals));
+  result->Set(String::NewSymbol("ccacheHits"), Uint32::New(record->ccache_hits));
+  result->Set(String::NewSymbol("ccacheMisses"), Uint32::New(record->ccache_misses));
+  result->Set(String::NewSymbol("enctype"), record->enctype[0] ? Handle<Value>(String::New(record->enctype)) : Handle<Value>(Null()));
+  result->Set(String::NewSymbol("error"), Int32::New(record->error));
+
+  return scope.Close(result);
+}
+
+// The retained outliers, oldest first
+Handle<Value> Trace::Outliers(const Arguments &args) {
+  HandleScope scope;
+  TraceRecord records[TRACE_RING_SIZE];
+  uint32_t count;
+  uint32_t first;
+
+  // Copy out under the lock, build the objects without it
+  uv_mutex_lock(&ring_mutex);
+  count = ring_count;
+  first = (ring_next + TRACE_RING_SIZE - ring_count) % TRACE_RING_SIZE;
+  for(uint32_t i = 0; i < count; i++) {
+    records[i] = ring[(first + i) % TRACE_RING_SIZE];
+  }
+  uv_mutex_unlock(&ring_mutex);
+
+  Local<Array> result = Array::New(count);
+  for(uint32_t i = 0; i < count; i++) {
+    result->Set(i, ToObject(&records[i]));
+  }
+
+  return scope.Close(result);
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <node.h>
+#include <v8.h>
+#include <krb5.h>
+
+// The trace callback is MIT only (1.9 and up), Heimdal and the older MIT
+// some systems ship have no way to see the KDC traffic. The responder
+// macros came with MIT 1.11, their presence is the check.
+#if defined(KRB5_RESPONDER_QUESTION_PASSWORD) && !defined(KERBEROS_NO_TRACE)
+# define KERBEROS_HAVE_TRACE 1
+#endif
+
+using namespace node;
+using namespace v8;
+
+// Slow traced fetches kept for inspection from js
+#define TRACE_RING_SIZE 64
+
+// What the KDC traffic behind one service ticket fetch looked like, pieced
+// together from the krb5 trace messages
+typedef struct TraceRecord {
+  // KerberosContext the fetch was made for
+  uint32_t context_id;
+  // Service the ticket is for
+  char service[256];
+  // Wall clock start in ms since the epoch
+  double timestamp;
+  // Whole fetch in nanoseconds
+  uint64_t duration;
+  // Last KDC we got an answer from, as krb5 prints it (dgram 10.0.0.1:88)
+  char kdc[64];
+  // Requests answered by a KDC, their summed and slowest round trip in ns
+  uint32_t requests;
+  uint64_t rtt_total;
+  uint64_t rtt_max;
+  // Requests sent again after a timeout
+  uint32_t retries;
+  // Did we go over to TCP after UDP
+  bool tcp_fallback;
+  // Cross realm referrals followed
+  uint32_t referrals;
+  // Credential cache lookups that found or missed the ticket
+  uint32_t ccache_hits;
+  uint32_t ccache_misses;
+  // Session key enctype of the ticket
+  char enctype[32];
+  // krb5 error of the fetch, 0 on success
+  int32_t error;
+} TraceRecord;
+
+// Opt in KDC visibility. The GSS calls use krb5 contexts we can't reach, so
+// when tracing is on the client init fetches the service ticket itself
+// through a krb5 context with a trace callback. The GSS step that follows
+// then finds it in the credential cache.
+class Trace {
+  public:
+    // Exposes the outlier ring buffer to js
+    static void Initialize(Handle<Object> target);
+
+#ifdef KERBEROS_HAVE_TRACE
+    // Fetch the ticket for a service@host name into ccache (NULL for the
+    // default one), recording the traffic, safe from any thread
+    static void Fetch(const char *service, const char *ccache_name, TraceRecord *record);
+#endif
+    // Keep the record in the ring buffer if it took threshold ns or more
+    static void Retain(const TraceRecord *record, uint64_t threshold);
+
+    // Turn a record into a js object, durations in ms
+    static Handle<Value> ToObject(const TraceRecord *record);
+
+  private:
+#ifdef KERBEROS_HAVE_TRACE
+    static void Callback(krb5_context context, const krb5_trace_info *info, void *data);
+#endif
+    static Handle<Value> Outliers(const Arguments &args);
+};
+
+#endif  // TRACE_H_
@@ -1,7 +0,0 @@
-#include "worker.h"
-
-Worker::Worker() {
-}
-
-Worker::~Worker() {  
-}
\ No newline at end of file
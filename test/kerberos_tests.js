@@ -31,4 +31,336 @@ exports['Simple initialize of Kerberos object'] = function(test) {
       test.done();
     });
   });
-}
\ No newline at end of file
+}
+
+exports['Context lifetime before establishment'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+    test.equal(null, err);
+    // Nothing negotiated yet
+    test.equal(null, context.flags);
+    test.equal(null, context.expiresAt);
+    test.equal(null, context.lifetime);
+    kerberos.authGSSClientClean(context, function() {
+      test.done();
+    });
+  });
+}
+
+exports['Cached ticket steps run inline but still call back asynchronously'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos({inlineCached: true});
+
+  var step = function(callback) {
+    kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+      var returned = false;
+      kerberos.authGSSClientStep(context, function(err, result) {
+        test.ok(returned);
+        callback();
+      });
+      returned = true;
+    });
+  }
+
+  // The second first leg finds the ticket fetched by the first one
+  step(function() {
+    var inlined = Kerberos.stats().inline;
+    step(function() {
+      test.ok(Kerberos.stats().inline > inlined);
+      test.done();
+    });
+  });
+}
+
+exports['Client init with an explicit mechanism'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  test.throws(function() {
+    kerberos.authGSSClientInit('mongodb@kdc.10gen.me', 0, {mech: 'ntlm'}, function() {});
+  });
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, {mech: 'krb5'}, function(err, context) {
+    test.equal(null, err);
+    kerberos.authGSSClientStep(context, function(err, result) {
+      // A raw krb5 first leg needs no SPNEGO negotiation
+      if(!err) test.equal(Kerberos.AUTH_GSS_CONTINUE, result);
+      kerberos.authGSSClientClean(context, function() {
+        test.done();
+      });
+    });
+  });
+}
+
+exports['Raw Buffer client step'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+    test.equal(null, err);
+
+    // Perform the first step without base64
+    kerberos.authGSSClientStepBuffer(context, function(err, result) {
+      test.equal(null, err);
+      test.ok(Buffer.isBuffer(context.responseBuffer));
+      test.ok(context.responseBuffer.length > 0);
+      test.equal(null, context.response);
+
+      test.done();
+    });
+  });
+}
+
+exports['Batch client step'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, first) {
+    test.equal(null, err);
+
+    kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, second) {
+      test.equal(null, err);
+
+      // Step both contexts with one callback
+      kerberos.stepMany([{context: first}, {context: second}], function(err, results) {
+        test.equal(null, err);
+        test.equal(2, results.length);
+        test.done();
+      });
+    });
+  });
+}
+
+exports['Cancel queued client step'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+    test.equal(null, err);
+
+    // The second step waits behind the first on the context
+    kerberos.authGSSClientStep(context, function() {});
+    var id = kerberos.authGSSClientStep(context, function(err, result) {
+      test.equal(Kerberos.AUTH_GSS_CANCELLED, err.code);
+      test.done();
+    });
+
+    test.equal(true, kerberos.cancel(id));
+  });
+}
+
+exports['Calls over maxQueued fail as overloaded'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos({maxInFlight: 1, maxQueued: 0});
+  var queuing = new Kerberos({maxInFlight: 1, maxQueued: 1});
+  var remaining = 5;
+
+  var done = function() {
+    if(--remaining == 0) test.done();
+  }
+
+  // The first takes the only slot, with no room to queue the others fail
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+    test.equal(null, err);
+    done();
+  });
+  test.equal(1, kerberos.inFlight());
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err) {
+    test.equal(Kerberos.AUTH_GSS_OVERLOADED, err.code);
+    done();
+  });
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err) {
+    test.equal(Kerberos.AUTH_GSS_OVERLOADED, err.code);
+    done();
+  });
+
+  test.equal(0, kerberos.queueDepth());
+  test.equal(1, kerberos.inFlight());
+
+  // Room for one waiting for the slot
+  queuing.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, done);
+  queuing.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, done);
+  test.equal(1, queuing.queueDepth());
+  test.equal(1, queuing.inFlight());
+}
+
+// Smallest Promise stand-in, the node versions we build for have none
+var Deferred = function(executor) {
+  var self = this;
+  this.waiting = [];
+
+  var settle = function(err, value) {
+    if(self.outcome) return;
+    self.outcome = [err, value];
+    self.waiting.forEach(function(callback) { callback(err, value); });
+  }
+
+  executor(function(value) { settle(null, value); }, function(err) { settle(err); });
+}
+
+Deferred.prototype.done = function(callback) {
+  if(this.outcome) return callback(this.outcome[0], this.outcome[1]);
+  this.waiting.push(callback);
+}
+
+// Duck typed AbortSignal
+var abortSignal = function() {
+  var signal = new (require('events').EventEmitter)();
+  signal.aborted = false;
+  signal.abort = function() {
+    signal.aborted = true;
+    signal.emit('abort');
+  }
+  return signal;
+}
+
+exports['Promise client step resolves with the response'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos({Promise: Deferred});
+
+  kerberos.promises.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG).done(function(err, context) {
+    test.equal(null, err);
+    kerberos.promises.authGSSClientStep(context).done(function(err, step) {
+      test.equal(null, err);
+      test.equal(Kerberos.AUTH_GSS_CONTINUE, step.result);
+      test.equal('string', typeof step.response);
+      test.ok(step.response.length > 0);
+      test.done();
+    });
+  });
+}
+
+exports['Promise client step aborts'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos({Promise: Deferred});
+  var aborted = abortSignal();
+  aborted.abort();
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+    test.equal(null, err);
+
+    // Aborted before the call, never queued
+    kerberos.promises.authGSSClientStep(context, {signal: aborted}).done(function(err) {
+      test.equal('AbortError', err.name);
+
+      // The second step waits behind the first on the context
+      var signal = abortSignal();
+      kerberos.authGSSClientStep(context, function() {});
+      kerberos.promises.authGSSClientStep(context, {signal: signal}).done(function(err) {
+        test.equal('AbortError', err.name);
+        test.equal(Kerberos.AUTH_GSS_CANCELLED, err.code);
+        test.done();
+      });
+
+      signal.abort();
+    });
+  });
+}
+
+exports['Stats snapshot'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, function(err, context) {
+    var stats = Kerberos.stats();
+    test.ok(stats.operations.clientInit.execute.count > 0);
+    test.equal('number', typeof stats.contexts);
+    test.done();
+  });
+}
+
+exports['Client init with shared credential'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.acquireCredential(function(err, credential) {
+    test.equal(null, err);
+    test.equal('string', typeof credential.principal);
+
+    kerberos.authGSSClientInit('mongodb@kdc.10gen.me', Kerberos.GSS_C_MUTUAL_FLAG, {credential: credential}, function(err, context) {
+      test.equal(null, err);
+
+      kerberos.authGSSClientStep(context, function(err, result) {
+        test.equal(null, err);
+        test.done();
+      });
+    });
+  });
+}
+
+exports['Keytab login requires a principal'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  test.throws(function() {
+    kerberos.acquireCredential({keytab: '/etc/krb5.keytab'}, function() {});
+  });
+  test.done();
+}
+
+exports['Ticket snapshots need a keytab login'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  test.throws(function() {
+    kerberos.acquireCredential({snapshot: '/tmp/kerberos.snapshot'}, function() {});
+  });
+
+  // Default ccache credentials have no private tickets to save
+  kerberos.acquireCredential(function(err, credential) {
+    test.equal(null, err);
+    kerberos.stopRenewal(credential);
+    test.throws(function() {
+      credential.saveSnapshot('/tmp/kerberos.snapshot');
+    });
+    test.done();
+  });
+}
+
+exports['Shared ccache needs a keytab login'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  test.throws(function() {
+    kerberos.acquireCredential({ccache: 'KCM:'}, function() {});
+  });
+
+  test.throws(function() {
+    kerberos.acquireCredential({principal: 'user@EXAMPLE.COM', keytab: '/etc/krb5.keytab'
+      , ccache: 'KCM:', snapshot: '/tmp/kerberos.snapshot'}, function() {});
+  });
+  test.done();
+}
+
+exports['Background credential renewal'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  // Renew right after acquiring
+  var kerberos = new Kerberos({renewAt: 0.000001});
+
+  kerberos.once('renewed', function(credential) {
+    kerberos.stopRenewal(credential);
+    test.ok(credential.expiresAt > Date.now());
+    test.done();
+  });
+
+  kerberos.acquireCredential(function(err, credential) {
+    test.equal(null, err);
+    test.ok(credential.expiresAt > credential.obtainedAt);
+  });
+}
+
+exports['Prefetch service tickets'] = function(test) {
+  var Kerberos = require('../lib/kerberos.js').Kerberos;
+  var kerberos = new Kerberos();
+
+  kerberos.prefetch(['mongodb@kdc.10gen.me'], function(err, results) {
+    test.equal(null, err);
+    test.equal(1, results.length);
+    test.equal('mongodb@kdc.10gen.me', results[0].service);
+    test.equal('number', typeof results[0].duration);
+    test.done();
+  });
+}